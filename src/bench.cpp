@@ -0,0 +1,477 @@
+// Benchmark harness that drives the storage engine API directly (no REPL).
+//
+// Every workload runs against a fresh database file: an optional load phase
+// fills it, then the timed run phase executes the operation mix. Results are
+// printed as one JSON document on stdout so they can be diffed and gated.
+//
+// Usage: ./db_bench [--workload <name>|all] [--rows N] [--ops N] [--seed S]
+//                [--theta T] [--page-size BYTES] [--pager buffered|mmap] [--io auto|uring|threads] [--direct] [--huge-pages] [--readahead LEAVES] [--compress] [--leaf-layout row|pax]
+//                [--file PATH]
+
+#include "common.h"
+#include "table.h"
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <random>
+#include <sys/stat.h>
+
+enum WorkloadType {
+    WORKLOAD_SEQUENTIAL_INSERT,
+    WORKLOAD_RANDOM_INSERT,
+    WORKLOAD_BATCH_INSERT,
+    WORKLOAD_POINT_READ,
+    WORKLOAD_MULTIGET,
+    WORKLOAD_RANGE_SCAN,
+    WORKLOAD_REVERSE_SCAN,
+    WORKLOAD_COLUMN_SUM,
+    WORKLOAD_DELETE_CHURN,
+    WORKLOAD_RANGE_DELETE,
+    WORKLOAD_YCSB
+};
+
+// Operation mix of a workload, in percent. YCSB A-F are expressed in these
+// terms; "latest" biases reads towards the most recently inserted ids.
+struct Workload {
+    const char* name;
+    WorkloadType type;
+    uint32_t read_percent;
+    uint32_t update_percent;
+    uint32_t insert_percent;
+    uint32_t scan_percent;
+    uint32_t read_modify_write_percent;
+    bool latest;
+};
+
+const Workload WORKLOADS[] = {
+    {"sequential_insert", WORKLOAD_SEQUENTIAL_INSERT, 0, 0, 100, 0, 0, false},
+    {"random_insert", WORKLOAD_RANDOM_INSERT, 0, 0, 100, 0, 0, false},
+    {"batch_insert", WORKLOAD_BATCH_INSERT, 0, 0, 100, 0, 0, false},
+    {"point_read", WORKLOAD_POINT_READ, 100, 0, 0, 0, 0, false},
+    {"multiget", WORKLOAD_MULTIGET, 100, 0, 0, 0, 0, false},
+    {"range_scan", WORKLOAD_RANGE_SCAN, 0, 0, 0, 100, 0, false},
+    {"reverse_scan", WORKLOAD_REVERSE_SCAN, 0, 0, 0, 100, 0, false},
+    {"column_sum", WORKLOAD_COLUMN_SUM, 0, 0, 0, 100, 0, false},
+    {"delete_churn", WORKLOAD_DELETE_CHURN, 0, 0, 0, 0, 0, false},
+    {"range_delete", WORKLOAD_RANGE_DELETE, 0, 0, 0, 0, 0, false},
+    {"ycsb_a", WORKLOAD_YCSB, 50, 50, 0, 0, 0, false},
+    {"ycsb_b", WORKLOAD_YCSB, 95, 5, 0, 0, 0, false},
+    {"ycsb_c", WORKLOAD_YCSB, 100, 0, 0, 0, 0, false},
+    {"ycsb_d", WORKLOAD_YCSB, 95, 0, 5, 0, 0, true},
+    {"ycsb_e", WORKLOAD_YCSB, 0, 0, 5, 95, 0, false},
+    {"ycsb_f", WORKLOAD_YCSB, 50, 0, 0, 0, 50, false},
+};
+const uint32_t NUM_WORKLOADS = sizeof(WORKLOADS) / sizeof(WORKLOADS[0]);
+
+// Short scans, as in YCSB E.
+const uint32_t MAX_SCAN_LENGTH = 100;
+// Rows per table_insert_batch call in batch_insert. Like a micro-batched
+// ingest, each batch holds the next ids in a shuffled order. Its latencies
+// are per batch.
+const uint32_t INSERT_BATCH_SIZE = 100;
+// Ids per table_multiget call in multiget, which looks up the same uniform
+// keys as point_read. Its latencies are per call.
+const uint32_t MULTIGET_BATCH_SIZE = 100;
+// Ids per table_delete_range call in range_delete, which deletes the oldest
+// rows first, as a retention job does. Its latencies are per call.
+const uint32_t RANGE_DELETE_LENGTH = 1000;
+// Rows per "select sum(length(username)) where id between ..." in
+// column_sum, a reporting query that reads one column. Compare it under
+// --leaf-layout row and pax. Its latencies are per query.
+const uint32_t COLUMN_SUM_LENGTH = 1000;
+
+struct BenchConfig {
+    std::string workload;
+    std::string filename;
+    uint32_t rows;
+    uint32_t ops;
+    uint64_t seed;
+    double theta;
+    PagerOptions pager;
+    LeafLayout leaf_layout;
+};
+
+struct BenchResult {
+    uint64_t operations;
+    double seconds;
+    std::vector<uint64_t> latencies_ns;
+    uint64_t pages_read;
+    uint64_t pages_written;
+    uint64_t file_size;
+};
+
+
+// --- Zipfian Key Generator ---
+// Gray et al., "Quickly Generating Billion-Record Synthetic Databases", as
+// used by YCSB. The item count may grow (inserts); zeta is extended
+// incrementally so that stays O(new items).
+struct Zipfian {
+    double theta;
+    double alpha;
+    double zeta2;
+    double zetan;
+    uint64_t items;
+};
+
+static void zipfian_grow(Zipfian* zipf, uint64_t items) {
+    for (uint64_t i = zipf->items + 1; i <= items; i++) {
+        zipf->zetan += 1.0 / std::pow((double)i, zipf->theta);
+    }
+    zipf->items = items;
+}
+
+static void zipfian_init(Zipfian* zipf, uint64_t items, double theta) {
+    zipf->theta = theta;
+    zipf->alpha = 1.0 / (1.0 - theta);
+    zipf->zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+    zipf->zetan = 0;
+    zipf->items = 0;
+    zipfian_grow(zipf, items);
+}
+
+// Returns a rank in [0, items); rank 0 is the most popular.
+static uint64_t zipfian_next(Zipfian* zipf, std::mt19937_64& rng) {
+    double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+    double uz = u * zipf->zetan;
+    if (uz < 1.0) {
+        return 0;
+    }
+    if (uz < zipf->zeta2) {
+        return 1;
+    }
+    double eta = (1.0 - std::pow(2.0 / zipf->items, 1.0 - zipf->theta)) / (1.0 - zipf->zeta2 / zipf->zetan);
+    uint64_t rank = (uint64_t)(zipf->items * std::pow(eta * u - eta + 1.0, zipf->alpha));
+    return std::min(rank, zipf->items - 1);
+}
+
+// Scatters popular ranks over the key space (YCSB's scrambled zipfian).
+static uint64_t fnv_hash64(uint64_t value) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < 8; i++) {
+        hash ^= value & 0xFF;
+        hash *= 0x100000001B3ULL;
+        value >>= 8;
+    }
+    return hash;
+}
+
+
+// --- Engine Helpers ---
+
+static void make_row(Row* row, uint32_t id, uint32_t version) {
+    row->id = id;
+    snprintf(row->username, sizeof(row->username), "user%u", id);
+    snprintf(row->email, sizeof(row->email), "user%u.v%u@example.com", id, version);
+}
+
+// Keeps reads from being optimized away.
+static volatile uint64_t bench_checksum = 0;
+
+static void scan(Table* table, uint32_t start_key, uint32_t length) {
+    Cursor* cursor = table_seek(table, start_key);
+    uint64_t checksum = 0;
+    for (uint32_t visited = 0; !(cursor->end_of_table) && visited < length; visited++) {
+        checksum += cursor_row(cursor).id();
+        cursor_advance(cursor);
+    }
+    delete cursor;
+    bench_checksum = bench_checksum + checksum;
+}
+
+// Walks back from the last row at or below `end_key`, as "order by id desc"
+// does.
+static void scan_reverse(Table* table, uint32_t end_key, uint32_t length) {
+    Cursor* cursor = table_find_last(table, end_key);
+    uint64_t checksum = 0;
+    for (uint32_t visited = 0; !(cursor->end_of_table) && visited < length; visited++) {
+        checksum += cursor_row(cursor).id();
+        cursor_retreat(cursor);
+    }
+    delete cursor;
+    bench_checksum = bench_checksum + checksum;
+}
+
+// Rewrites the row's email in place, as "update <id> set email = ..." does.
+static void update(Table* table, uint32_t id, uint32_t version) {
+    Row row;
+    make_row(&row, id, version);
+    table_update(table, &row, UPDATE_EMAIL);
+}
+
+
+// --- Workload Runner ---
+
+static BenchResult run_workload(const Workload& workload, const BenchConfig& config) {
+    unlink(config.filename.c_str());
+    Database* database = db_open(config.filename, config.pager);
+    Table* table = db_table(database, DEFAULT_TABLE_NAME);
+    if (config.leaf_layout != LEAF_LAYOUT_ROW) {
+        db_drop_table(database, DEFAULT_TABLE_NAME);
+        table = db_create_table(database, DEFAULT_TABLE_NAME, config.leaf_layout);
+    }
+    std::mt19937_64 rng(config.seed);
+    Row row;
+
+    // Load phase (untimed).
+    uint32_t max_id = 0;
+    std::vector<uint32_t> live_ids;
+    if (workload.type != WORKLOAD_SEQUENTIAL_INSERT && workload.type != WORKLOAD_RANDOM_INSERT &&
+        workload.type != WORKLOAD_BATCH_INSERT) {
+        for (uint32_t id = 1; id <= config.rows; id++) {
+            make_row(&row, id, 0);
+            table_insert(table, &row);
+            live_ids.push_back(id);
+        }
+        max_id = config.rows;
+    }
+
+    std::vector<uint32_t> insert_order;
+    if (workload.type == WORKLOAD_SEQUENTIAL_INSERT || workload.type == WORKLOAD_RANDOM_INSERT ||
+        workload.type == WORKLOAD_BATCH_INSERT) {
+        for (uint32_t id = 1; id <= config.ops; id++) {
+            insert_order.push_back(id);
+        }
+        if (workload.type == WORKLOAD_RANDOM_INSERT) {
+            std::shuffle(insert_order.begin(), insert_order.end(), rng);
+        }
+        for (uint32_t i = 0; workload.type == WORKLOAD_BATCH_INSERT && i < config.ops; i += INSERT_BATCH_SIZE) {
+            std::shuffle(insert_order.begin() + i, insert_order.begin() + std::min(i + INSERT_BATCH_SIZE, config.ops), rng);
+        }
+    }
+
+    Zipfian zipf;
+    zipfian_init(&zipf, std::max<uint32_t>(max_id, 1), config.theta);
+    std::uniform_int_distribution<uint32_t> percent(0, 99);
+    std::vector<Row> batch;
+    std::vector<ExecuteResult> batch_results(INSERT_BATCH_SIZE);
+    std::vector<uint32_t> multiget_keys;
+    std::vector<Row> multiget_rows(MULTIGET_BATCH_SIZE);
+    std::unique_ptr<bool[]> multiget_found(new bool[MULTIGET_BATCH_SIZE]);
+
+    BenchResult result;
+    result.operations = config.ops;
+    result.latencies_ns.reserve(config.ops);
+    // Pages dirtied by the load are written now, so the flush after the run
+    // counts only what the workload itself wrote.
+    pager_flush_all(table->pager);
+    uint64_t pages_read_before = metrics_counter(METRIC_PAGES_READ);
+    uint64_t pages_written_before = metrics_counter(METRIC_PAGES_WRITTEN);
+    uint64_t run_start = metrics_now_ns();
+
+    for (uint32_t op = 0; op < config.ops; op++) {
+        uint64_t op_start = metrics_now_ns();
+        switch (workload.type) {
+            case WORKLOAD_SEQUENTIAL_INSERT:
+            case WORKLOAD_RANDOM_INSERT:
+                make_row(&row, insert_order[op], 0);
+                table_insert(table, &row);
+                break;
+            case WORKLOAD_BATCH_INSERT:
+                make_row(&row, insert_order[op], 0);
+                batch.push_back(row);
+                if (batch.size() < INSERT_BATCH_SIZE && op + 1 < config.ops) {
+                    continue;
+                }
+                table_insert_batch(table, batch.data(), batch.size(), batch_results.data());
+                batch.clear();
+                break;
+            case WORKLOAD_POINT_READ:
+                {
+                RowView view;
+                if (table_lookup(table, std::uniform_int_distribution<uint32_t>(1, max_id)(rng), &view)) {
+                    bench_checksum = bench_checksum + view.id();
+                }
+                }
+                break;
+            case WORKLOAD_MULTIGET:
+                multiget_keys.push_back(std::uniform_int_distribution<uint32_t>(1, max_id)(rng));
+                if (multiget_keys.size() < MULTIGET_BATCH_SIZE && op + 1 < config.ops) {
+                    continue;
+                }
+                bench_checksum = bench_checksum + table_multiget(table, multiget_keys.data(), multiget_keys.size(),
+                                                                 multiget_rows.data(), multiget_found.get());
+                multiget_keys.clear();
+                break;
+            case WORKLOAD_RANGE_SCAN:
+                scan(table, std::uniform_int_distribution<uint32_t>(1, max_id)(rng), MAX_SCAN_LENGTH);
+                break;
+            case WORKLOAD_REVERSE_SCAN:
+                scan_reverse(table, std::uniform_int_distribution<uint32_t>(1, max_id)(rng), MAX_SCAN_LENGTH);
+                break;
+            case WORKLOAD_COLUMN_SUM:
+                {
+                uint32_t start = std::uniform_int_distribution<uint32_t>(1, max_id)(rng);
+                AggregateResult sum = table_aggregate(table, AGGREGATE_SUM, COLUMN_USERNAME_LENGTH, start, start + COLUMN_SUM_LENGTH - 1);
+                bench_checksum = bench_checksum + sum.value;
+                }
+                break;
+            case WORKLOAD_DELETE_CHURN:
+                {
+                // Replace a random live row with a brand new id.
+                uint32_t index = std::uniform_int_distribution<uint32_t>(0, live_ids.size() - 1)(rng);
+                table_delete(table, live_ids[index]);
+                live_ids[index] = ++max_id;
+                make_row(&row, max_id, 0);
+                table_insert(table, &row);
+                }
+                break;
+            case WORKLOAD_RANGE_DELETE:
+                if ((op + 1) % RANGE_DELETE_LENGTH != 0 && op + 1 < config.ops) {
+                    continue;
+                }
+                table_delete_range(table, op - op % RANGE_DELETE_LENGTH + 1, op + 1);
+                break;
+            case WORKLOAD_YCSB:
+                {
+                uint64_t rank = zipfian_next(&zipf, rng);
+                uint32_t id = workload.latest ? max_id - (uint32_t)rank
+                                              : 1 + (uint32_t)(fnv_hash64(rank) % max_id);
+                uint32_t dice = percent(rng);
+                RowView view;
+                if (dice < workload.read_percent) {
+                    table_lookup(table, id, &view);
+                } else if ((dice -= workload.read_percent) < workload.update_percent) {
+                    update(table, id, op + 1);
+                } else if ((dice -= workload.update_percent) < workload.insert_percent) {
+                    make_row(&row, ++max_id, 0);
+                    table_insert(table, &row);
+                    zipfian_grow(&zipf, max_id);
+                } else if ((dice -= workload.insert_percent) < workload.scan_percent) {
+                    scan(table, id, std::uniform_int_distribution<uint32_t>(1, MAX_SCAN_LENGTH)(rng));
+                } else {
+                    table_lookup(table, id, &view);
+                    update(table, id, op + 1);
+                }
+                }
+                break;
+        }
+        result.latencies_ns.push_back(metrics_now_ns() - op_start);
+    }
+
+    result.seconds = (metrics_now_ns() - run_start) / 1e9;
+    pager_flush_all(table->pager);
+    result.pages_read = metrics_counter(METRIC_PAGES_READ) - pages_read_before;
+    result.pages_written = metrics_counter(METRIC_PAGES_WRITTEN) - pages_written_before;
+    db_close(database);
+
+    struct stat file_stat;
+    result.file_size = (stat(config.filename.c_str(), &file_stat) == 0) ? file_stat.st_size : 0;
+    unlink(config.filename.c_str());
+    return result;
+}
+
+static uint64_t percentile(const std::vector<uint64_t>& sorted, double fraction) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = (size_t)std::ceil(fraction * sorted.size());
+    return sorted[std::min(sorted.size(), std::max<size_t>(index, 1)) - 1];
+}
+
+static void print_result(const Workload& workload, BenchResult& result, bool last) {
+    std::sort(result.latencies_ns.begin(), result.latencies_ns.end());
+    double throughput = result.seconds > 0 ? result.operations / result.seconds : 0;
+    printf("    {\"name\": \"%s\", \"operations\": %llu, \"seconds\": %.6f, \"throughput_ops_per_sec\": %.1f,\n",
+           workload.name, (unsigned long long)result.operations, result.seconds, throughput);
+    printf("     \"latency_ns\": {\"p50\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu},\n",
+           (unsigned long long)percentile(result.latencies_ns, 0.50),
+           (unsigned long long)percentile(result.latencies_ns, 0.99),
+           (unsigned long long)percentile(result.latencies_ns, 0.999),
+           (unsigned long long)(result.latencies_ns.empty() ? 0 : result.latencies_ns.back()));
+    printf("     \"pages_read\": %llu, \"pages_written\": %llu, \"file_size_bytes\": %llu}%s\n",
+           (unsigned long long)result.pages_read, (unsigned long long)result.pages_written,
+           (unsigned long long)result.file_size, last ? "" : ",");
+}
+
+static void usage() {
+    std::cerr << "Usage: db_bench [--workload <name>|all] [--rows N] [--ops N] [--seed S] [--theta T] [--page-size BYTES] [--pager buffered|mmap] [--io auto|uring|threads] [--direct] [--huge-pages] [--readahead LEAVES] [--compress] [--leaf-layout row|pax] [--file PATH]" << std::endl;
+    std::cerr << "Workloads:";
+    for (uint32_t i = 0; i < NUM_WORKLOADS; i++) {
+        std::cerr << " " << WORKLOADS[i].name;
+    }
+    std::cerr << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char* argv[]) {
+    // The defaults build a tree several times larger than the buffer pool,
+    // so the read workloads exercise eviction and real page reads.
+    BenchConfig config = {"all", "bench.db", 100000, 100000, 42, 0.99, PagerOptions(), LEAF_LAYOUT_ROW};
+    for (int i = 1; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--direct") {
+            config.pager.direct_io = true;
+            continue;
+        }
+        if (flag == "--huge-pages") {
+            config.pager.huge_pages = true;
+            continue;
+        }
+        if (flag == "--compress") {
+            config.pager.compress = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            usage();
+        }
+        std::string value = argv[++i];
+        if (flag == "--workload") {
+            config.workload = value;
+        } else if (flag == "--rows") {
+            config.rows = strtoul(value.c_str(), nullptr, 10);
+        } else if (flag == "--ops") {
+            config.ops = strtoul(value.c_str(), nullptr, 10);
+        } else if (flag == "--seed") {
+            config.seed = strtoull(value.c_str(), nullptr, 10);
+        } else if (flag == "--theta") {
+            config.theta = strtod(value.c_str(), nullptr);
+        } else if (flag == "--page-size") {
+            config.pager.page_size = strtoul(value.c_str(), nullptr, 10);
+        } else if (flag == "--pager") {
+            if (!parse_pager_backend(value, &config.pager.backend)) {
+                usage();
+            }
+        } else if (flag == "--readahead") {
+            config.pager.readahead_window = strtoul(value.c_str(), nullptr, 10);
+        } else if (flag == "--io") {
+            if (!parse_io_backend(value, &config.pager.io_backend)) {
+                usage();
+            }
+        } else if (flag == "--leaf-layout") {
+            if (!parse_leaf_layout(value, &config.leaf_layout)) {
+                usage();
+            }
+        } else if (flag == "--file") {
+            config.filename = value;
+        } else {
+            usage();
+        }
+    }
+    if (config.rows == 0 || config.theta <= 0 || config.theta >= 1 || !pager_valid_page_size(config.pager.page_size)) {
+        usage();
+    }
+
+    std::vector<const Workload*> selected;
+    for (uint32_t i = 0; i < NUM_WORKLOADS; i++) {
+        if (config.workload == "all" || config.workload == WORKLOADS[i].name) {
+            selected.push_back(&WORKLOADS[i]);
+        }
+    }
+    if (selected.empty()) {
+        usage();
+    }
+
+    printf("{\n  \"config\": {\"rows\": %u, \"ops\": %u, \"seed\": %llu, \"theta\": %.2f, \"page_size\": %u, \"pager\": \"%s\", \"io\": \"%s\", \"direct\": %s, \"compress\": %s, \"leaf_layout\": \"%s\"},\n",
+           config.rows, config.ops, (unsigned long long)config.seed, config.theta, config.pager.page_size,
+           config.pager.backend == PAGER_BACKEND_MMAP ? "mmap" : "buffered", io_backend_name(config.pager.io_backend),
+           config.pager.direct_io ? "true" : "false", config.pager.compress ? "true" : "false", leaf_layout_name(config.leaf_layout));
+    printf("  \"workloads\": [\n");
+    for (size_t i = 0; i < selected.size(); i++) {
+        BenchResult result = run_workload(*selected[i], config);
+        print_result(*selected[i], result, i + 1 == selected.size());
+        fflush(stdout);
+    }
+    printf("  ]\n}\n");
+    return 0;
+}
@@ -1,150 +1,491 @@
 #include "btree.h"
 #include "table.h"
+#include "metrics.h"
+#include "explain.h"
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 // --- Internal Function Prototypes ---
+// An internal node viewed as a flat list of (child, max key, row count)
+// entries; the last entry is the right child, whose key the node does not
+// store. Structural changes edit the list and write it back, which keeps
+// keys and counts moving together and repacks the keys.
+struct InternalEntry {
+    uint32_t child_page_num;
+    uint32_t key;
+    uint32_t count;
+};
+
 static void create_new_root(Table* table, uint32_t right_child_page_num);
-static uint32_t get_node_max_key(Pager* pager, void* node);
-static void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key);
-static void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num);
+static uint32_t get_node_max_key(Pager* pager, const NodeLayout& layout, void* node);
+static void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t left_page_num, uint32_t right_page_num);
+static void internal_node_split_and_insert(Table* table, uint32_t page_num, std::vector<InternalEntry>& entries);
 static void leaf_node_split_and_insert(Table* table, uint32_t page_num, uint32_t cell_num, uint32_t key, Row* value);
+static void leaf_node_split_batch(Table* table, uint32_t page_num, Row* const* rows, uint32_t num_rows);
+static void leaf_node_link_after(Pager* pager, uint32_t page_num, void* node, uint32_t new_page_num, void* new_node);
+static void adjust_counts_above(Table* table, uint32_t page_num, int32_t delta);
+static void leaf_node_rebalance(Table* table, uint32_t page_num);
+static void internal_node_rebalance(Table* table, uint32_t page_num);
 static void adjust_root(Table* table);
-static void remove_child_from_internal_node(void* node, uint32_t child_page_num);
 static uint32_t get_node_child_index(void* parent_node, uint32_t child_page_num);
-static void merge_nodes(Table* table, uint32_t node_page_num, uint32_t neighbor_page_num, uint32_t parent_page_num, uint32_t parent_key_index);
-static uint32_t internal_node_find_child(void* node, uint32_t key);
+static uint32_t leaf_node_cell_lower_bound(const NodeLayout& layout, void* node, uint32_t end, uint32_t key);
+static void write_key_lane(char* lane, uint32_t lane_size, uint32_t value);
+static void internal_node_read_entries(void* node, std::vector<InternalEntry>* entries);
+static void internal_node_write_entries(const NodeLayout& layout, void* node, const InternalEntry* entries, uint32_t num_entries);
+static uint32_t internal_node_key_lane_size(const InternalEntry* entries, uint32_t num_entries);
+static bool internal_node_fits(const NodeLayout& layout, const InternalEntry* entries, uint32_t num_entries);
+static void internal_node_store(Table* table, uint32_t page_num, std::vector<InternalEntry>& entries);
+static void set_children_parent(Pager* pager, const InternalEntry* entries, uint32_t num_entries, uint32_t parent_page_num);
+static void free_subtree(Pager* pager, uint32_t page_num, uint32_t height);
+static void pack_internal_keys(Table* table, uint32_t page_num);
+static uint32_t bulk_level_size(uint32_t items, uint32_t max_items, uint32_t target);
+static uint32_t share_size(uint32_t total, uint32_t parts, uint32_t part);
+static uint32_t share_owner(uint32_t total, uint32_t parts, uint32_t item);
+template <typename Lane>
+static uint32_t lanes_lower_bound(const char* lanes, uint32_t count, Lane target);
+template <typename Lane>
+static Lane read_lane(const char* lanes, uint32_t index);
+#ifdef __SSE2__
+static __m128i splat_lanes(uint8_t value);
+static __m128i splat_lanes(uint16_t value);
+static __m128i splat_lanes(uint32_t value);
+static __m128i lanes_below(__m128i block, __m128i target, uint8_t);
+static __m128i lanes_below(__m128i block, __m128i target, uint16_t);
+static __m128i lanes_below(__m128i block, __m128i target, uint32_t);
+#endif
 
 
 // --- Function Implementations ---
 
-void initialize_leaf_node(void* node) {
+void initialize_leaf_node(void* node, const NodeLayout& layout) {
     set_node_type(node, NODE_LEAF);
     set_node_root(node, false);
     *leaf_node_num_cells(node) = 0;
     *leaf_node_next_leaf(node) = 0; // 0 represents no sibling
+    *leaf_node_prev_leaf(node) = 0;
+    *leaf_node_values_start(node) = layout.leaf_values_start;
     *node_parent(node) = 0;
+    leaf_node_index_keys(layout, node);
+}
+
+// Rebuilds a row leaf's packed keys from the ids in its rows: the smallest
+// key is the base, and the lanes are the narrowest that hold the largest.
+// PAX leaves search their id minipage as it is.
+void leaf_node_index_keys(const NodeLayout& layout, void* node) {
+    if (layout.leaf_layout != LEAF_LAYOUT_ROW) {
+        return;
+    }
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t base = num_cells > 0 ? leaf_node_key(layout, node, 0) : 0;
+    uint32_t range = num_cells > 0 ? leaf_node_key(layout, node, num_cells - 1) - base : 0;
+    uint32_t lane_size = range <= UINT8_MAX ? sizeof(uint8_t) : range <= UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t);
+    *leaf_node_key_base(node) = base;
+    *leaf_node_key_width(node) = lane_size * 8;
+    char* deltas = leaf_node_key_deltas(node);
+    for (uint32_t i = 0; i < num_cells; i++) {
+        write_key_lane(deltas + i * lane_size, lane_size, leaf_node_key(layout, node, i) - base);
+    }
+}
+
+// Adds the key of a cell just inserted, whose row is written and counted,
+// shifting the lanes above it; a key outside the leaf's frame repacks the
+// leaf instead.
+void leaf_node_index_insert(const NodeLayout& layout, void* node, uint32_t cell_num) {
+    if (layout.leaf_layout != LEAF_LAYOUT_ROW) {
+        return;
+    }
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t key = leaf_node_key(layout, node, cell_num);
+    uint32_t base = *leaf_node_key_base(node);
+    uint32_t lane_size = *leaf_node_key_width(node) / 8;
+    if (num_cells == 1 || key < base || (lane_size < sizeof(uint32_t) && (key - base) >> (lane_size * 8) != 0)) {
+        leaf_node_index_keys(layout, node);
+        return;
+    }
+    char* deltas = leaf_node_key_deltas(node);
+    memmove(deltas + (cell_num + 1) * lane_size, deltas + cell_num * lane_size, (num_cells - 1 - cell_num) * lane_size);
+    write_key_lane(deltas + cell_num * lane_size, lane_size, key - base);
+}
+
+// Drops the key of a cell just removed. The frame stays valid for the keys
+// that are left, if wider than they need.
+void leaf_node_index_remove(const NodeLayout& layout, void* node, uint32_t cell_num) {
+    if (layout.leaf_layout != LEAF_LAYOUT_ROW) {
+        return;
+    }
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    uint32_t lane_size = *leaf_node_key_width(node) / 8;
+    char* deltas = leaf_node_key_deltas(node);
+    memmove(deltas + cell_num * lane_size, deltas + (cell_num + 1) * lane_size, (num_cells - cell_num) * lane_size);
+}
+
+// Lanes are little-endian, as is every integer in the file.
+static void write_key_lane(char* lane, uint32_t lane_size, uint32_t value) {
+    memcpy(lane, &value, lane_size);
+}
+
+bool parse_leaf_layout(const std::string& name, LeafLayout* leaf_layout) {
+    if (name == "row") {
+        *leaf_layout = LEAF_LAYOUT_ROW;
+    } else if (name == "pax") {
+        *leaf_layout = LEAF_LAYOUT_PAX;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* leaf_layout_name(LeafLayout leaf_layout) {
+    return leaf_layout == LEAF_LAYOUT_PAX ? "pax" : "row";
 }
 
 void initialize_internal_node(void* node) {
     set_node_type(node, NODE_INTERNAL);
     set_node_root(node, false);
     *internal_node_num_keys(node) = 0;
+    *internal_node_child_count(node, 0) = 0;
+    *internal_node_key_width(node) = INTERNAL_NODE_KEY_SIZE * 8;
     *node_parent(node) = 0;
 }
 
-static uint32_t internal_node_find_child(void* node, uint32_t key) {
-    uint32_t num_keys = *internal_node_num_keys(node);
+// Index of the child whose subtree `key` belongs in: the first whose key
+// is >= `key`, or the right child.
+uint32_t internal_node_find_child(void* node, uint32_t key) {
+    return packed_keys_lower_bound(internal_node_key_lanes(node), *internal_node_key_width(node) / 8,
+                                   internal_node_key_base(node), *internal_node_num_keys(node), key);
+}
+
+// Index of the first of `count` sorted keys, stored as `lane_size`-byte
+// distances from `base`, that is >= `key`; `count` if there is none. The
+// keys are searched as they are: `key` is taken into their frame, and if
+// it falls outside, it is below or past every key; otherwise it is
+// compared with the lanes at their own width, so dense keys compare 16
+// per SSE2 instruction.
+uint32_t packed_keys_lower_bound(const char* lanes, uint32_t lane_size, uint32_t base, uint32_t count, uint32_t key) {
+    if (count == 0 || key < base) {
+        return 0;
+    }
+    uint32_t delta = key - base;
+    switch (lane_size) {
+        case sizeof(uint8_t):
+            return delta > UINT8_MAX ? count : lanes_lower_bound<uint8_t>(lanes, count, (uint8_t)delta);
+        case sizeof(uint16_t):
+            return delta > UINT16_MAX ? count : lanes_lower_bound<uint16_t>(lanes, count, (uint16_t)delta);
+        default:
+            return lanes_lower_bound<uint32_t>(lanes, count, delta);
+    }
+}
+
+// Index of the first of `count` sorted lanes that is >= `target`. A binary
+// search narrows the range to PACKED_KEYS_SCAN_LANES lanes, which are then
+// compared a register at a time; as the lanes are sorted, the number below
+// `target` is the answer.
+template <typename Lane>
+static uint32_t lanes_lower_bound(const char* lanes, uint32_t count, Lane target) {
     uint32_t min_index = 0;
-    uint32_t max_index = num_keys;
-    while (min_index != max_index) {
-        uint32_t index = (min_index + max_index) / 2;
-        uint32_t key_to_right = *internal_node_key(node, index);
-        if (key_to_right >= key) {
-            max_index = index;
-        } else {
+    uint32_t one_past_max_index = count;
+    while (one_past_max_index - min_index > PACKED_KEYS_SCAN_LANES) {
+        uint32_t index = (min_index + one_past_max_index) / 2;
+        if (read_lane<Lane>(lanes, index) < target) {
             min_index = index + 1;
+        } else {
+            one_past_max_index = index + 1;
         }
     }
-    return min_index;
+
+    uint32_t index = min_index;
+#ifdef __SSE2__
+    // SSE2 only compares signed integers; flipping the sign bit of both
+    // sides gives the unsigned order.
+    const uint32_t lanes_per_block = sizeof(__m128i) / sizeof(Lane);
+    const __m128i sign_bit = splat_lanes((Lane)(1u << (sizeof(Lane) * 8 - 1)));
+    const __m128i target_block = _mm_xor_si128(splat_lanes(target), sign_bit);
+    for (; index + lanes_per_block <= one_past_max_index; index += lanes_per_block) {
+        __m128i block = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(lanes + index * sizeof(Lane))), sign_bit);
+        // One bit per byte, so a lane below the target sets sizeof(Lane) bits.
+        int below = _mm_movemask_epi8(lanes_below(block, target_block, Lane()));
+        if (below != 0xFFFF) {
+            return index + __builtin_popcount(below) / sizeof(Lane);
+        }
+    }
+#endif
+    while (index < one_past_max_index && read_lane<Lane>(lanes, index) < target) {
+        index++;
+    }
+    return index;
+}
+
+template <typename Lane>
+static Lane read_lane(const char* lanes, uint32_t index) {
+    Lane lane;
+    memcpy(&lane, lanes + index * sizeof(Lane), sizeof(Lane));
+    return lane;
+}
+
+#ifdef __SSE2__
+static __m128i splat_lanes(uint8_t value) {
+    return _mm_set1_epi8((char)value);
+}
+static __m128i splat_lanes(uint16_t value) {
+    return _mm_set1_epi16((short)value);
+}
+static __m128i splat_lanes(uint32_t value) {
+    return _mm_set1_epi32((int)value);
+}
+static __m128i lanes_below(__m128i block, __m128i target, uint8_t) {
+    return _mm_cmplt_epi8(block, target);
+}
+static __m128i lanes_below(__m128i block, __m128i target, uint16_t) {
+    return _mm_cmplt_epi16(block, target);
+}
+static __m128i lanes_below(__m128i block, __m128i target, uint32_t) {
+    return _mm_cmplt_epi32(block, target);
+}
+#endif
+
+uint32_t node_row_count(void* node) {
+    if (get_node_type(node) == NODE_LEAF) {
+        return *leaf_node_num_cells(node);
+    }
+    uint32_t num_keys = *internal_node_num_keys(node);
+    uint32_t total = 0;
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        total += *internal_node_child_count(node, i);
+    }
+    return total;
+}
+
+// Walks the search path for `key` and adds `delta` to every subtree count on
+// it. Called before a leaf gains or loses a row, while the path still leads
+// to that leaf; any split or merge that follows recomputes the counts of the
+// nodes it touches, so totals above them stay correct.
+void btree_adjust_counts(Table* table, uint32_t key, int32_t delta) {
+    Pager* pager = table->pager;
+    void* node = get_page(pager, table->root_page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t index = internal_node_find_child(node, key);
+        *internal_node_child_count(node, index) += delta;
+        node = get_page(pager, *internal_node_child(node, index));
+    }
 }
 
 void leaf_node_insert(Table* table, uint32_t page_num, uint32_t cell_num, uint32_t key, Row* value) {
+    btree_adjust_counts(table, key, 1);
+
     void* node = get_page(table->pager, page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
 
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
+    if (num_cells >= table->layout.leaf_max_cells) {
         leaf_node_split_and_insert(table, page_num, cell_num, key, value);
         return;
     }
 
     if (cell_num < num_cells) {
-        for (uint32_t i = num_cells; i > cell_num; i--) {
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
-        }
+        leaf_node_move_cells(table->layout, node, cell_num + 1, node, cell_num, num_cells - cell_num);
     }
 
     *(leaf_node_num_cells(node)) += 1;
-    *(leaf_node_key(node, cell_num)) = key;
-    serialize_row(value, leaf_node_value(node, cell_num));
+    leaf_node_write_row(table->layout, node, cell_num, value);
+    leaf_node_index_insert(table->layout, node, cell_num);
+}
+
+// Inserts rows sorted by id, all of which belong in this leaf and none of
+// which it holds yet. If they fit, counts on the path are adjusted once for
+// the lot and the existing cells are shifted up in runs, from the back, so
+// each moves once; otherwise the leaf is split as many ways as needed.
+void leaf_node_insert_batch(Table* table, uint32_t page_num, Row* const* rows, uint32_t num_rows) {
+    void* node = get_page(table->pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (num_cells + num_rows > table->layout.leaf_max_cells) {
+        leaf_node_split_batch(table, page_num, rows, num_rows);
+        return;
+    }
+    btree_adjust_counts(table, rows[0]->id, num_rows);
+
+    uint32_t end = num_cells; // cells below this have not moved yet
+    for (uint32_t remaining = num_rows; remaining > 0; remaining--) {
+        const Row* row = rows[remaining - 1];
+        uint32_t position = leaf_node_cell_lower_bound(table->layout, node, end, row->id);
+        leaf_node_move_cells(table->layout, node, position + remaining, node, position, end - position);
+        leaf_node_write_row(table->layout, node, position + remaining - 1, row);
+        end = position;
+    }
+    *leaf_node_num_cells(node) = num_cells + num_rows;
+    leaf_node_index_keys(table->layout, node);
 }
 
 static void leaf_node_split_and_insert(Table* table, uint32_t page_num, uint32_t cell_num, uint32_t key, Row* value) {
+    metrics_increment(METRIC_LEAF_SPLITS);
+    explain_phase(table->pager->trace, PHASE_SPLIT);
     Pager* pager = table->pager;
     void* old_node = get_page(pager, page_num);
-    uint32_t old_max_key_before_split = get_node_max_key(pager, old_node);
     uint32_t new_page_num = get_unused_page_num(pager);
     void* new_node = get_page(pager, new_page_num);
-    initialize_leaf_node(new_node);
+    initialize_leaf_node(new_node, table->layout);
 
     *node_parent(new_node) = *node_parent(old_node);
-    *leaf_node_next_leaf(new_node) = *leaf_node_next_leaf(old_node);
-    *leaf_node_next_leaf(old_node) = new_page_num;
+    leaf_node_link_after(pager, page_num, old_node, new_page_num, new_node);
 
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
+    for (int32_t i = table->layout.leaf_max_cells; i >= 0; i--) {
         void* destination_node;
-        if (i >= static_cast<int32_t>(LEAF_NODE_MAX_CELLS / 2)) {
+        if (i >= static_cast<int32_t>(table->layout.leaf_left_split_count)) {
             destination_node = new_node;
         } else {
             destination_node = old_node;
         }
-        uint32_t index_within_node = i % (LEAF_NODE_MAX_CELLS / 2);
-        void* destination = leaf_node_cell(destination_node, index_within_node);
+        uint32_t index_within_node = i % table->layout.leaf_left_split_count;
 
         if (i == (int32_t)cell_num) {
-            serialize_row(value, leaf_node_value(destination_node, index_within_node));
-            *leaf_node_key(destination_node, index_within_node) = key;
+            leaf_node_write_row(table->layout, destination_node, index_within_node, value);
         } else if (i > (int32_t)cell_num) {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+            leaf_node_move_cells(table->layout, destination_node, index_within_node, old_node, i - 1, 1);
         } else {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+            leaf_node_move_cells(table->layout, destination_node, index_within_node, old_node, i, 1);
         }
     }
 
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_MAX_CELLS / 2;
-    *(leaf_node_num_cells(new_node)) = (LEAF_NODE_MAX_CELLS + 1) / 2;
+    *(leaf_node_num_cells(old_node)) = table->layout.leaf_left_split_count;
+    *(leaf_node_num_cells(new_node)) = table->layout.leaf_right_split_count;
+    leaf_node_index_keys(table->layout, old_node);
+    leaf_node_index_keys(table->layout, new_node);
 
     if (is_node_root(old_node)) {
         create_new_root(table, new_page_num);
     } else {
-        uint32_t parent_page_num = *node_parent(old_node);
-        uint32_t new_max_key = get_node_max_key(pager, old_node);
-        void* parent = get_page(pager, parent_page_num);
-        update_internal_node_key(parent, old_max_key_before_split, new_max_key);
-        internal_node_insert(table, parent_page_num, new_page_num);
+        internal_node_insert(table, *node_parent(old_node), page_num, new_page_num);
+    }
+}
+
+// Merges the leaf's cells with the new rows and spreads the result evenly
+// over the leaf and as many new leaves as it takes, chained in key order.
+// The new leaves are then registered with the parent one at a time, each
+// right after the one before it, as an ordinary split would. Their rows are
+// added to the ancestors' counts just before, so a parent that splits on
+// the way recomputes counts that already agree with everything above it.
+static void leaf_node_split_batch(Table* table, uint32_t page_num, Row* const* rows, uint32_t num_rows) {
+    explain_phase(table->pager->trace, PHASE_SPLIT);
+    Pager* pager = table->pager;
+    void* old_node = get_page(pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(old_node);
+    uint32_t total = num_cells + num_rows;
+    // The leaf's own cells are merged from a copy, since it is refilled first.
+    std::vector<char> old_copy(pager->page_size);
+    memcpy(old_copy.data(), old_node, pager->page_size);
+    uint32_t cell = 0, row = 0;
+
+    uint32_t num_leaves = (total + table->layout.leaf_max_cells - 1) / table->layout.leaf_max_cells;
+    std::vector<uint32_t> page_nums = {page_num};
+    void* node = old_node;
+    for (uint32_t leaf = 0; leaf < num_leaves; leaf++) {
+        if (leaf > 0) {
+            metrics_increment(METRIC_LEAF_SPLITS);
+            uint32_t new_page_num = get_unused_page_num(pager);
+            void* new_node = get_page(pager, new_page_num);
+            initialize_leaf_node(new_node, table->layout);
+            *node_parent(new_node) = *node_parent(node);
+            leaf_node_link_after(pager, page_nums.back(), node, new_page_num, new_node);
+            page_nums.push_back(new_page_num);
+            node = new_node;
+        }
+        uint32_t count = total / num_leaves + (leaf < total % num_leaves ? 1 : 0);
+        for (uint32_t i = 0; i < count; i++) {
+            if (row == num_rows || (cell < num_cells && leaf_node_key(table->layout, old_copy.data(), cell) < rows[row]->id)) {
+                leaf_node_move_cells(table->layout, node, i, old_copy.data(), cell, 1);
+                cell++;
+            } else {
+                leaf_node_write_row(table->layout, node, i, rows[row]);
+                row++;
+            }
+        }
+        *leaf_node_num_cells(node) = count;
+        leaf_node_index_keys(table->layout, node);
+    }
+
+    adjust_counts_above(table, page_num, (int32_t)*leaf_node_num_cells(old_node) - (int32_t)num_cells);
+    uint32_t left_page_num = page_num;
+    for (uint32_t i = 1; i < page_nums.size(); i++) {
+        void* left = get_page(pager, left_page_num);
+        adjust_counts_above(table, left_page_num, *leaf_node_num_cells(get_page(pager, page_nums[i])));
+        if (is_node_root(left)) {
+            // Only the first new leaf can meet the root; its left sibling
+            // moves out of the root page into a fresh one.
+            create_new_root(table, page_nums[i]);
+        } else {
+            internal_node_insert(table, *node_parent(left), left_page_num, page_nums[i]);
+        }
+        left_page_num = page_nums[i];
+    }
+}
+
+// Chains a freshly initialized leaf in right after `node`, fixing the back
+// link of the leaf that used to follow it.
+static void leaf_node_link_after(Pager* pager, uint32_t page_num, void* node, uint32_t new_page_num, void* new_node) {
+    uint32_t next_page_num = *leaf_node_next_leaf(node);
+    *leaf_node_next_leaf(new_node) = next_page_num;
+    *leaf_node_prev_leaf(new_node) = page_num;
+    *leaf_node_next_leaf(node) = new_page_num;
+    if (next_page_num != 0) {
+        *leaf_node_prev_leaf(get_page(pager, next_page_num)) = new_page_num;
     }
 }
 
+// Adds `delta` to the count of every subtree holding `page_num`, following
+// parent pointers; unlike btree_adjust_counts it needs no key that routes
+// to the page.
+static void adjust_counts_above(Table* table, uint32_t page_num, int32_t delta) {
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+    while (!is_node_root(node)) {
+        uint32_t parent_page_num = *node_parent(node);
+        void* parent = get_page(pager, parent_page_num);
+        *internal_node_child_count(parent, get_node_child_index(parent, page_num)) += delta;
+        page_num = parent_page_num;
+        node = parent;
+    }
+}
 
 static void create_new_root(Table* table, uint32_t right_child_page_num) {
+    metrics_increment(METRIC_ROOT_SPLITS);
     Pager* pager = table->pager;
     void* root = get_page(pager, table->root_page_num);
     void* right_child = get_page(pager, right_child_page_num);
     uint32_t left_child_page_num = get_unused_page_num(pager);
     void* left_child = get_page(pager, left_child_page_num);
 
-    memcpy(left_child, root, PAGE_SIZE);
+    memcpy(left_child, root, table->layout.page_size);
     set_node_root(left_child, false);
 
+    if (get_node_type(left_child) == NODE_INTERNAL) {
+        std::vector<InternalEntry> entries;
+        internal_node_read_entries(left_child, &entries);
+        set_children_parent(pager, entries.data(), entries.size(), left_child_page_num);
+    } else if (*leaf_node_next_leaf(left_child) != 0) {
+        // The leaf split off the root still links back to the root page.
+        *leaf_node_prev_leaf(get_page(pager, *leaf_node_next_leaf(left_child))) = left_child_page_num;
+    }
+
     initialize_internal_node(root);
     set_node_root(root, true);
-    *internal_node_num_keys(root) = 1;
-    *internal_node_child(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = get_node_max_key(pager, left_child);
-    *internal_node_key(root, 0) = left_child_max_key;
-    *internal_node_right_child(root) = right_child_page_num;
+    // The right child's key is not stored.
+    InternalEntry entries[] = {{left_child_page_num, get_node_max_key(pager, table->layout, left_child), node_row_count(left_child)},
+                               {right_child_page_num, 0, node_row_count(right_child)}};
+    internal_node_write_entries(table->layout, root, entries, 2);
 
     *node_parent(left_child) = table->root_page_num;
     *node_parent(right_child) = table->root_page_num;
 }
 
-static uint32_t get_node_max_key(Pager* pager, void* node) {
+static uint32_t get_node_max_key(Pager* pager, const NodeLayout& layout, void* node) {
     switch (get_node_type(node)) {
         case NODE_INTERNAL:
             {
-            void* right_child = get_page(pager, *internal_node_right_child(node));
-            return get_node_max_key(pager, right_child);
+            void* right_child = get_page_for_read(pager, *internal_node_right_child(node));
+            return get_node_max_key(pager, layout, right_child);
             }
         case NODE_LEAF:
-            return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+            return leaf_node_key(layout, node, *leaf_node_num_cells(node) - 1);
         default:
             std::cout << "Error: tried to get max key of unknown node type" << std::endl;
             exit(EXIT_FAILURE);
@@ -166,132 +507,593 @@ static uint32_t get_node_child_index(void* node, uint32_t child_page_num) {
     exit(EXIT_FAILURE);
 }
 
-static void update_internal_node_key(void* node, uint32_t old_key, uint32_t new_key) {
-    uint32_t old_child_index = internal_node_find_child(node, old_key);
-    *internal_node_key(node, old_child_index) = new_key;
+// Index of the first of the leaf's cells below `end` whose key is >= `key`,
+// read from the rows, for writers that move cells before the packed keys
+// are rebuilt.
+static uint32_t leaf_node_cell_lower_bound(const NodeLayout& layout, void* node, uint32_t end, uint32_t key) {
+    uint32_t begin = 0;
+    while (begin < end) {
+        uint32_t middle = (begin + end) / 2;
+        if (leaf_node_key(layout, node, middle) < key) {
+            begin = middle + 1;
+        } else {
+            end = middle;
+        }
+    }
+    return begin;
 }
 
-static void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num) {
-    Pager* pager = table->pager;
-    void* parent = get_page(pager, parent_page_num);
-    void* child = get_page(pager, child_page_num);
-    uint32_t child_max_key = get_node_max_key(pager, child);
-    uint32_t index = internal_node_find_child(parent, child_max_key);
-
-    uint32_t original_num_keys = *internal_node_num_keys(parent);
-    *internal_node_num_keys(parent) += 1;
+// Keys and counts straight from the node. The right child's key is not
+// stored and reads as 0; a caller that moves the right child in front of
+// another entry fills it in.
+static void internal_node_read_entries(void* node, std::vector<InternalEntry>* entries) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    entries->clear();
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        InternalEntry entry = {*internal_node_child(node, i), i < num_keys ? internal_node_key(node, i) : 0,
+                               *internal_node_child_count(node, i)};
+        entries->push_back(entry);
+    }
+}
 
-    if (original_num_keys >= INTERNAL_NODE_MAX_CELLS) {
-        printf("Need to implement splitting internal node\n");
+// Lays the entries out as the node's cells and packs their keys, all but
+// the right child's. Callers check internal_node_fits first.
+static void internal_node_write_entries(const NodeLayout& layout, void* node, const InternalEntry* entries, uint32_t num_entries) {
+    uint32_t num_keys = num_entries - 1;
+    uint32_t lane_size = internal_node_key_lane_size(entries, num_entries);
+    if (num_keys > internal_node_max_cells(layout.page_size, lane_size)) {
+        std::cerr << "Internal node entries do not fit in a page." << std::endl;
         exit(EXIT_FAILURE);
     }
+    *internal_node_num_keys(node) = num_keys;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        *internal_node_child(node, i) = entries[i].child_page_num;
+        *internal_node_child_count(node, i) = entries[i].count;
+    }
+    *internal_node_right_child(node) = entries[num_keys].child_page_num;
+    *internal_node_child_count(node, num_keys) = entries[num_keys].count;
 
-    uint32_t right_child_page_num = *internal_node_right_child(parent);
-    void* right_child = get_page(pager, right_child_page_num);
+    uint32_t base = lane_size < INTERNAL_NODE_KEY_SIZE ? entries[0].key : 0;
+    *internal_node_key_width(node) = lane_size * 8;
+    if (lane_size < INTERNAL_NODE_KEY_SIZE) {
+        memcpy(internal_node_cell(node, num_keys), &base, INTERNAL_NODE_KEY_BASE_SIZE);
+    }
+    char* lanes = internal_node_key_lanes(node);
+    for (uint32_t i = 0; i < num_keys; i++) {
+        write_key_lane(lanes + i * lane_size, lane_size, entries[i].key - base);
+    }
+}
 
-    if (child_max_key > get_node_max_key(pager, right_child)) {
-        /* Replace right child */
-        *internal_node_child(parent, original_num_keys) = right_child_page_num;
-        *internal_node_key(parent, original_num_keys) = get_node_max_key(pager, right_child);
-        *internal_node_right_child(parent) = child_page_num;
-    } else {
-        /* Make room for new cell */
-        for (uint32_t i = original_num_keys; i > index; i--) {
-            memcpy(internal_node_cell(parent, i), internal_node_cell(parent, i - 1), INTERNAL_NODE_CELL_SIZE);
-        }
-        *internal_node_child(parent, index) = child_page_num;
-        *internal_node_key(parent, index) = child_max_key;
+// The narrowest lane that holds the range of the keys a node of these
+// entries stores.
+static uint32_t internal_node_key_lane_size(const InternalEntry* entries, uint32_t num_entries) {
+    uint32_t range = num_entries > 1 ? entries[num_entries - 2].key - entries[0].key : 0;
+    return range <= UINT8_MAX ? sizeof(uint8_t) : range <= UINT16_MAX ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+static bool internal_node_fits(const NodeLayout& layout, const InternalEntry* entries, uint32_t num_entries) {
+    return num_entries - 1 <= internal_node_max_cells(layout.page_size, internal_node_key_lane_size(entries, num_entries));
+}
+
+// Writes the entries back to their node, or splits it if a key change
+// widened its lanes past what the node holds.
+static void internal_node_store(Table* table, uint32_t page_num, std::vector<InternalEntry>& entries) {
+    if (internal_node_fits(table->layout, entries.data(), entries.size())) {
+        internal_node_write_entries(table->layout, get_page(table->pager, page_num), entries.data(), entries.size());
+        return;
     }
+    internal_node_split_and_insert(table, page_num, entries);
 }
 
-static void remove_child_from_internal_node(void* node, uint32_t child_page_num) {
-    uint32_t index = get_node_child_index(node, child_page_num);
-    uint32_t num_keys = *internal_node_num_keys(node);
-    
-    // Shift keys and children
-    for(uint32_t i = index; i < num_keys -1; ++i) {
-        *internal_node_key(node, i) = *internal_node_key(node, i+1);
-        *internal_node_child(node, i+1) = *internal_node_child(node, i+2);
+static void set_children_parent(Pager* pager, const InternalEntry* entries, uint32_t num_entries, uint32_t parent_page_num) {
+    for (uint32_t i = 0; i < num_entries; i++) {
+        *node_parent(get_page(pager, entries[i].child_page_num)) = parent_page_num;
     }
-    *internal_node_right_child(node) = *internal_node_child(node, num_keys-1);
-    (*internal_node_num_keys(node))--;
 }
 
+// Registers `right_page_num`, freshly split off from `left_page_num`, in
+// their parent and refreshes both children's keys and counts.
+static void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t left_page_num, uint32_t right_page_num) {
+    Pager* pager = table->pager;
+    void* parent = get_page(pager, parent_page_num);
+    void* left = get_page(pager, left_page_num);
+    void* right = get_page(pager, right_page_num);
+
+    std::vector<InternalEntry> entries;
+    internal_node_read_entries(parent, &entries);
+    uint32_t index = get_node_child_index(parent, left_page_num);
+    entries[index].key = get_node_max_key(pager, table->layout, left);
+    entries[index].count = node_row_count(left);
+    InternalEntry entry = {right_page_num, get_node_max_key(pager, table->layout, right), node_row_count(right)};
+    entries.insert(entries.begin() + index + 1, entry);
+    *node_parent(right) = parent_page_num;
+    internal_node_store(table, parent_page_num, entries);
+}
+
+static void internal_node_split_and_insert(Table* table, uint32_t page_num, std::vector<InternalEntry>& entries) {
+    metrics_increment(METRIC_INTERNAL_SPLITS);
+    Pager* pager = table->pager;
+    uint32_t new_page_num = get_unused_page_num(pager);
+    void* new_node = get_page(pager, new_page_num);
+    void* old_node = get_page(pager, page_num);
+    initialize_internal_node(new_node);
+
+    uint32_t num_left = (entries.size() + 1) / 2;
+    uint32_t num_right = entries.size() - num_left;
+    internal_node_write_entries(table->layout, old_node, entries.data(), num_left);
+    internal_node_write_entries(table->layout, new_node, entries.data() + num_left, num_right);
+    set_children_parent(pager, entries.data() + num_left, num_right, new_page_num);
+
+    if (is_node_root(old_node)) {
+        create_new_root(table, new_page_num);
+    } else {
+        uint32_t parent_page_num = *node_parent(old_node);
+        *node_parent(new_node) = parent_page_num;
+        internal_node_insert(table, parent_page_num, page_num, new_page_num);
+    }
+}
+
+// Collapses a root that has been left with a single child by copying that
+// child into the root page, so the root always stays at root_page_num.
 static void adjust_root(Table* table) {
     Pager* pager = table->pager;
     void* root_node = get_page(pager, table->root_page_num);
 
     if(get_node_type(root_node) == NODE_INTERNAL && *internal_node_num_keys(root_node) == 0) {
-        // If root is an internal node with no keys, its first child becomes the new root.
-        uint32_t new_root_page_num = *internal_node_child(root_node, 0);
-        void* new_root_node = get_page(pager, new_root_page_num);
-        set_node_root(new_root_node, true);
-        *node_parent(new_root_node) = 0;
-        table->root_page_num = new_root_page_num;
+        metrics_increment(METRIC_ROOT_COLLAPSES);
+        uint32_t child_page_num = *internal_node_right_child(root_node);
+        void* child = get_page(pager, child_page_num);
+        memcpy(root_node, child, table->layout.page_size);
+        set_node_root(root_node, true);
+        *node_parent(root_node) = 0;
+        if (get_node_type(root_node) == NODE_INTERNAL) {
+            std::vector<InternalEntry> entries;
+            internal_node_read_entries(root_node, &entries);
+            set_children_parent(pager, entries.data(), entries.size(), table->root_page_num);
+        }
+        pager_free_page(pager, child_page_num);
+    }
+}
+
+// Removes entry `index + 1` after its contents were folded into entry
+// `index`, then lets the parent rebalance itself.
+static void internal_node_remove_right_of(Table* table, uint32_t page_num, uint32_t index, uint32_t merged_count) {
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+    std::vector<InternalEntry> entries;
+    internal_node_read_entries(node, &entries);
+    entries[index].key = entries[index + 1].key;
+    entries[index].count = merged_count;
+    entries.erase(entries.begin() + index + 1);
+    internal_node_write_entries(table->layout, node, entries.data(), entries.size());
+    internal_node_rebalance(table, page_num);
+}
+
+static void leaf_node_rebalance(Table* table, uint32_t page_num) {
+    explain_phase(table->pager->trace, PHASE_REBALANCE);
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+    uint32_t parent_page_num = *node_parent(node);
+    void* parent = get_page(pager, parent_page_num);
+    uint32_t child_index = get_node_child_index(parent, page_num);
+
+    // Always work on an adjacent (left, right) pair under the same parent.
+    uint32_t left_index = child_index > 0 ? child_index - 1 : child_index;
+    uint32_t left_page_num = *internal_node_child(parent, left_index);
+    uint32_t right_page_num = *internal_node_child(parent, left_index + 1);
+    void* left = get_page(pager, left_page_num);
+    void* right = get_page(pager, right_page_num);
+    uint32_t left_cells = *leaf_node_num_cells(left);
+    uint32_t right_cells = *leaf_node_num_cells(right);
+
+    if (left_cells + right_cells <= table->layout.leaf_max_cells) {
+        // Merge the right leaf into the left one.
+        metrics_increment(METRIC_LEAF_MERGES);
+        leaf_node_move_cells(table->layout, left, left_cells, right, 0, right_cells);
+        *leaf_node_num_cells(left) = left_cells + right_cells;
+        leaf_node_index_keys(table->layout, left);
+        uint32_t next_page_num = *leaf_node_next_leaf(right);
+        *leaf_node_next_leaf(left) = next_page_num;
+        if (next_page_num != 0) {
+            *leaf_node_prev_leaf(get_page(pager, next_page_num)) = left_page_num;
+        }
+        internal_node_remove_right_of(table, parent_page_num, left_index, left_cells + right_cells);
+        pager_free_page(pager, right_page_num);
+        return;
     }
+
+    // Borrow from the sibling, which has more than enough, what the leaf
+    // lacks: one cell after a single delete, possibly more after a range
+    // deletion.
+    metrics_increment(METRIC_LEAF_BORROWS);
+    if (left_page_num == page_num) {
+        uint32_t moved = table->layout.leaf_min_cells - left_cells;
+        leaf_node_move_cells(table->layout, left, left_cells, right, 0, moved);
+        leaf_node_move_cells(table->layout, right, 0, right, moved, right_cells - moved);
+        left_cells += moved;
+        right_cells -= moved;
+    } else {
+        uint32_t moved = table->layout.leaf_min_cells - right_cells;
+        leaf_node_move_cells(table->layout, right, moved, right, 0, right_cells);
+        leaf_node_move_cells(table->layout, right, 0, left, left_cells - moved, moved);
+        left_cells -= moved;
+        right_cells += moved;
+    }
+    *leaf_node_num_cells(left) = left_cells;
+    *leaf_node_num_cells(right) = right_cells;
+    leaf_node_index_keys(table->layout, left);
+    leaf_node_index_keys(table->layout, right);
+    std::vector<InternalEntry> entries;
+    internal_node_read_entries(parent, &entries);
+    entries[left_index].key = leaf_node_key(table->layout, left, left_cells - 1);
+    entries[left_index].count = left_cells;
+    entries[left_index + 1].count = right_cells;
+    internal_node_store(table, parent_page_num, entries);
 }
 
-static void merge_nodes(Table* table, uint32_t node_page_num, uint32_t neighbor_page_num, uint32_t parent_page_num, uint32_t parent_key_index) {
+static void internal_node_rebalance(Table* table, uint32_t page_num) {
     Pager* pager = table->pager;
-    void* node = get_page(pager, node_page_num);
-    void* neighbor_node = get_page(pager, neighbor_page_num);
-    void* parent_node = get_page(pager, parent_page_num);
+    void* node = get_page(pager, page_num);
 
-    // Move cells from node to neighbor
-    uint32_t neighbor_insertion_index = *leaf_node_num_cells(neighbor_node);
-    for (uint32_t i = 0; i < *leaf_node_num_cells(node); i++) {
-        memcpy(leaf_node_cell(neighbor_node, neighbor_insertion_index + i), leaf_node_cell(node, i), LEAF_NODE_CELL_SIZE);
+    if (is_node_root(node)) {
+        adjust_root(table);
+        return;
+    }
+    if (*internal_node_num_keys(node) + 1 >= table->layout.internal_min_children) {
+        return;
+    }
+
+    uint32_t parent_page_num = *node_parent(node);
+    void* parent = get_page(pager, parent_page_num);
+    uint32_t child_index = get_node_child_index(parent, page_num);
+    uint32_t left_index = child_index > 0 ? child_index - 1 : child_index;
+    uint32_t left_page_num = *internal_node_child(parent, left_index);
+    uint32_t right_page_num = *internal_node_child(parent, left_index + 1);
+    void* left = get_page(pager, left_page_num);
+    void* right = get_page(pager, right_page_num);
+
+    std::vector<InternalEntry> entries;
+    std::vector<InternalEntry> right_entries;
+    internal_node_read_entries(left, &entries);
+    internal_node_read_entries(right, &right_entries);
+    // The left node's right child comes to sit in front of the right
+    // node's children, so its key, the left node's largest, is stored.
+    entries.back().key = internal_node_key(parent, left_index);
+    uint32_t num_from_left = entries.size();
+    entries.insert(entries.end(), right_entries.begin(), right_entries.end());
+
+    if (internal_node_fits(table->layout, entries.data(), entries.size())) {
+        metrics_increment(METRIC_INTERNAL_MERGES);
+        internal_node_write_entries(table->layout, left, entries.data(), entries.size());
+        set_children_parent(pager, entries.data() + num_from_left, entries.size() - num_from_left, left_page_num);
+        uint32_t total = 0;
+        for (uint32_t i = 0; i < entries.size(); i++) {
+            total += entries[i].count;
+        }
+        internal_node_remove_right_of(table, parent_page_num, left_index, total);
+        pager_free_page(pager, right_page_num);
+        return;
     }
-    *leaf_node_num_cells(neighbor_node) += *leaf_node_num_cells(node);
-    *leaf_node_next_leaf(neighbor_node) = *leaf_node_next_leaf(node);
 
-    remove_child_from_internal_node(parent_node, node_page_num);
-    
-    // Recursively rebalance parent
-    if(!is_node_root(parent_node) && *internal_node_num_keys(parent_node) < 1) { // A non-root internal node must have at least one key
-        // Not implemented: Full recursive rebalancing of internal nodes
+    // Redistribute the children evenly between the two siblings.
+    metrics_increment(METRIC_INTERNAL_BORROWS);
+    uint32_t num_left = entries.size() / 2;
+    internal_node_write_entries(table->layout, left, entries.data(), num_left);
+    internal_node_write_entries(table->layout, right, entries.data() + num_left, entries.size() - num_left);
+    if (num_left > num_from_left) {
+        set_children_parent(pager, entries.data() + num_from_left, num_left - num_from_left, left_page_num);
+    } else {
+        set_children_parent(pager, entries.data() + num_left, num_from_left - num_left, right_page_num);
     }
-    adjust_root(table);
+    uint32_t left_count = node_row_count(left);
+    uint32_t right_count = node_row_count(right);
+    std::vector<InternalEntry> parent_entries;
+    internal_node_read_entries(parent, &parent_entries);
+    parent_entries[left_index].key = entries[num_left - 1].key;
+    parent_entries[left_index].count = left_count;
+    parent_entries[left_index + 1].count = right_count;
+    internal_node_store(table, parent_page_num, parent_entries);
 }
 
 void btree_delete(Table* table, uint32_t page_num, uint32_t cell_num, uint32_t key) {
+    btree_adjust_counts(table, key, -1);
+
     Pager* pager = table->pager;
     void* node = get_page(pager, page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
 
     // Remove the cell
-    for (uint32_t i = cell_num; i < num_cells - 1; i++) {
-        memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i + 1), LEAF_NODE_CELL_SIZE);
-    }
+    leaf_node_move_cells(table->layout, node, cell_num, node, cell_num + 1, num_cells - 1 - cell_num);
     *leaf_node_num_cells(node) -= 1;
-    
+    leaf_node_index_remove(table->layout, node, cell_num);
+
     if (is_node_root(node)) {
         return; 
     }
 
-    if (*leaf_node_num_cells(node) < LEAF_NODE_MIN_CELLS) {
-        // Node is under-utilized, needs rebalancing
-        uint32_t parent_page_num = *node_parent(node);
-        void* parent_node = get_page(pager, parent_page_num);
-        uint32_t child_index = get_node_child_index(parent_node, page_num);
-
-        uint32_t neighbor_page_num;
-        uint32_t key_index;
-        if(child_index > 0) { // Has left sibling
-            neighbor_page_num = *internal_node_child(parent_node, child_index - 1);
-            key_index = child_index - 1;
-        } else { // No left sibling, must have right one
-            neighbor_page_num = *internal_node_child(parent_node, child_index + 1);
-            key_index = child_index;
+    if (*leaf_node_num_cells(node) < table->layout.leaf_min_cells) {
+        // Node is under-utilized: borrow from or merge with a sibling.
+        leaf_node_rebalance(table, page_num);
+    }
+}
+
+
+// --- Range Deletion ---
+// Removes the keys in [start_key, end_key] from the subtree at `page_num`,
+// `height` levels above the leaves, and returns how many there were.
+// Children wholly inside the range are dropped from their parent and freed
+// along with everything below them; only the children the range starts and
+// ends in are descended into. Counts are kept exact, but the nodes along the
+// two edges of the range may be left under-full (never empty: a child that
+// loses every row is freed) and the leaf chain is not relinked; the caller
+// does both. Returns with the node empty if the range covered all of it.
+uint32_t btree_delete_range(Table* table, uint32_t page_num, uint32_t height, uint32_t start_key, uint32_t end_key) {
+    Pager* pager = table->pager;
+    void* node = get_page(pager, page_num);
+    if (height == 0) {
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        uint32_t first = leaf_node_cell_lower_bound(table->layout, node, num_cells, start_key);
+        uint32_t last = end_key == UINT32_MAX ? num_cells : leaf_node_cell_lower_bound(table->layout, node, num_cells, end_key + 1);
+        leaf_node_move_cells(table->layout, node, first, node, last, num_cells - last);
+        *leaf_node_num_cells(node) = num_cells - (last - first);
+        leaf_node_index_keys(table->layout, node);
+        return last - first;
+    }
+
+    std::vector<InternalEntry> entries;
+    internal_node_read_entries(node, &entries);
+    uint32_t first = internal_node_find_child(node, start_key);
+    uint32_t last = internal_node_find_child(node, end_key);
+
+    uint32_t removed = 0;
+    std::vector<InternalEntry> kept(entries.begin(), entries.begin() + first);
+    for (uint32_t i = first; i <= last; i++) {
+        if (i > first && i < last) {
+            removed += entries[i].count;
+            free_subtree(pager, entries[i].child_page_num, height - 1);
+            continue;
+        }
+        uint32_t child_removed = btree_delete_range(table, entries[i].child_page_num, height - 1, start_key, end_key);
+        removed += child_removed;
+        entries[i].count -= child_removed;
+        if (entries[i].count == 0) {
+            pager_free_page(pager, entries[i].child_page_num);
+            continue;
         }
-        
-        merge_nodes(table, page_num, neighbor_page_num, parent_page_num, key_index);
+        kept.push_back(entries[i]);
     }
+    kept.insert(kept.end(), entries.begin() + last + 1, entries.end());
+    if (!kept.empty()) {
+        internal_node_write_entries(table->layout, node, kept.data(), kept.size());
+    }
+    return removed;
+}
+
+// Rebalances the nodes on the path to `key` that a range deletion left
+// under-full. The topmost one goes first, after the root has shed levels
+// with a single child, so the node being fixed always has a sibling to
+// merge with or borrow from; each pass starts again from the root.
+void btree_rebalance_path(Table* table, uint32_t key) {
+    Pager* pager = table->pager;
+    explain_phase(pager->trace, PHASE_REBALANCE);
+    while (true) {
+        void* node = get_page_for_read(pager, table->root_page_num);
+        if (get_node_type(node) == NODE_INTERNAL && *internal_node_num_keys(node) == 0) {
+            adjust_root(table);
+            continue;
+        }
+        bool rebalanced = false;
+        while (!rebalanced && get_node_type(node) == NODE_INTERNAL) {
+            uint32_t page_num = *internal_node_child(node, internal_node_find_child(node, key));
+            node = get_page_for_read(pager, page_num);
+            if (get_node_type(node) == NODE_LEAF && *leaf_node_num_cells(node) < table->layout.leaf_min_cells) {
+                leaf_node_rebalance(table, page_num);
+                rebalanced = true;
+            } else if (get_node_type(node) == NODE_INTERNAL &&
+                       *internal_node_num_keys(node) + 1 < table->layout.internal_min_children) {
+                internal_node_rebalance(table, page_num);
+                rebalanced = true;
+            }
+        }
+        if (!rebalanced) {
+            return;
+        }
+    }
+}
+
+// Frees every page below the root, `height` levels above the leaves, and
+// leaves the root an empty leaf.
+void btree_truncate(Table* table, uint32_t height) {
+    Pager* pager = table->pager;
+    void* root = get_page(pager, table->root_page_num);
+    if (height > 0) {
+        std::vector<uint32_t> children;
+        for (uint32_t i = 0; i <= *internal_node_num_keys(root); i++) {
+            children.push_back(*internal_node_child(root, i));
+        }
+        for (uint32_t child_page_num : children) {
+            free_subtree(pager, child_page_num, height - 1);
+        }
+    }
+    initialize_leaf_node(root, table->layout);
+    set_node_root(root, true);
+}
+
+// Frees a subtree. Only internal nodes are read, for their children's page
+// numbers; leaves are put on the free list unseen.
+static void free_subtree(Pager* pager, uint32_t page_num, uint32_t height) {
+    if (height > 0) {
+        void* node = get_page_for_read(pager, page_num);
+        uint32_t num_keys = *internal_node_num_keys(node);
+        for (uint32_t i = 0; i <= num_keys; i++) {
+            free_subtree(pager, *internal_node_child(node, i), height - 1);
+        }
+    }
+    pager_free_page(pager, page_num);
 }
 
 
-void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
+// --- Format Upgrades ---
+// Before format version 7 an internal node kept its keys whole, each in a
+// (child, key, count) cell right after the header. Rewrites every internal
+// node of the table's tree with packed keys; a node holds at least as many
+// cells packed as it did whole. The root's children are pointed back at it
+// on the way, as a file from before the header page moved its root.
+void btree_pack_internal_keys(Table* table) {
+    Pager* pager = table->pager;
+    pack_internal_keys(table, table->root_page_num);
+    pager_begin_operation(pager);
+    void* root = get_page_for_read(pager, table->root_page_num);
+    if (get_node_type(root) != NODE_INTERNAL) {
+        return;
+    }
+    std::vector<InternalEntry> entries;
+    internal_node_read_entries(root, &entries);
+    set_children_parent(pager, entries.data(), entries.size(), table->root_page_num);
+}
+
+static void pack_internal_keys(Table* table, uint32_t page_num) {
+    const uint32_t unpacked_cell_size = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE + INTERNAL_NODE_COUNT_SIZE;
+    Pager* pager = table->pager;
+    pager_begin_operation(pager);
     void* node = get_page(pager, page_num);
+    if (get_node_type(node) != NODE_INTERNAL) {
+        return;
+    }
+    uint32_t num_keys = *internal_node_num_keys(node);
+    std::vector<InternalEntry> entries;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        const char* cell = (const char*)node + INTERNAL_NODE_HEADER_SIZE + i * unpacked_cell_size;
+        InternalEntry entry;
+        memcpy(&entry.child_page_num, cell, INTERNAL_NODE_CHILD_SIZE);
+        memcpy(&entry.key, cell + INTERNAL_NODE_CHILD_SIZE, INTERNAL_NODE_KEY_SIZE);
+        memcpy(&entry.count, cell + INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE, INTERNAL_NODE_COUNT_SIZE);
+        entries.push_back(entry);
+    }
+    // The right child and its count are in the header, where they were.
+    InternalEntry right = {*internal_node_right_child(node), 0, *internal_node_child_count(node, num_keys)};
+    entries.push_back(right);
+    internal_node_write_entries(table->layout, node, entries.data(), entries.size());
+
+    // Every child is on the same level, so the first tells whether there
+    // is a level of internal nodes below.
+    if (get_node_type(get_page_for_read(pager, entries[0].child_page_num)) == NODE_INTERNAL) {
+        for (const InternalEntry& entry : entries) {
+            pack_internal_keys(table, entry.child_page_num);
+        }
+    }
+}
+
+
+// --- Bulk Loading ---
+// Builds a tree of the `num_rows` rows `source` yields, in key order, into
+// a file with nothing past its root page, table->root_page_num. The
+// number of nodes on every level is fixed up front, so each node's page is
+// known before it is written: the other internal nodes follow the root
+// level by level, and the leaves come last, in key order in consecutive
+// pages. Rows and children are spread evenly over each level at about
+// `fill_percent` of a node's capacity, never below the minimum a node may
+// hold, so every node is written once and never split.
+void btree_bulk_load(Table* table, Cursor* source, uint32_t num_rows, uint32_t fill_percent) {
+    Pager* pager = table->pager;
+    const NodeLayout& layout = table->layout;
+    uint32_t internal_max_children = layout.internal_max_cells + 1;
+    uint32_t leaf_target = std::max(layout.leaf_min_cells, layout.leaf_max_cells * fill_percent / 100);
+    uint32_t internal_target = std::max(layout.internal_min_children, internal_max_children * fill_percent / 100);
+
+    // Nodes per level, leaves first, and the first page of each level.
+    std::vector<uint32_t> level_sizes = {bulk_level_size(num_rows, layout.leaf_max_cells, leaf_target)};
+    while (level_sizes.back() > 1) {
+        level_sizes.push_back(bulk_level_size(level_sizes.back(), internal_max_children, internal_target));
+    }
+    uint32_t num_levels = level_sizes.size();
+    std::vector<uint32_t> first_pages(num_levels);
+    uint32_t next_page_num = table->root_page_num;
+    for (uint32_t level = num_levels; level-- > 0;) {
+        first_pages[level] = next_page_num;
+        next_page_num += level_sizes[level];
+    }
+
+    // Each level is written left to right and leaves behind one entry per
+    // node for the level above.
+    std::vector<InternalEntry> entries;
+    uint32_t num_leaves = level_sizes[0];
+    for (uint32_t i = 0; i < num_leaves; i++) {
+        pager_begin_operation(pager);
+        uint32_t page_num = first_pages[0] + i;
+        void* leaf = get_page(pager, page_num);
+        initialize_leaf_node(leaf, layout);
+        set_node_root(leaf, num_levels == 1);
+        *node_parent(leaf) = num_levels == 1 ? 0 : first_pages[1] + share_owner(num_leaves, level_sizes[1], i);
+        *leaf_node_next_leaf(leaf) = i + 1 < num_leaves ? page_num + 1 : 0;
+        *leaf_node_prev_leaf(leaf) = i > 0 ? page_num - 1 : 0;
+        uint32_t count = share_size(num_rows, num_leaves, i);
+        for (uint32_t cell = 0; cell < count; cell++) {
+            leaf_node_copy_row(layout, leaf, cell, cursor_row(source));
+            cursor_advance(source);
+        }
+        *leaf_node_num_cells(leaf) = count;
+        leaf_node_index_keys(layout, leaf);
+        InternalEntry entry = {page_num, count > 0 ? leaf_node_key(layout, leaf, count - 1) : 0, count};
+        entries.push_back(entry);
+    }
+
+    for (uint32_t level = 1; level < num_levels; level++) {
+        std::vector<InternalEntry> children;
+        children.swap(entries);
+        uint32_t first_child = 0;
+        for (uint32_t i = 0; i < level_sizes[level]; i++) {
+            pager_begin_operation(pager);
+            uint32_t page_num = first_pages[level] + i;
+            uint32_t num_children = share_size(children.size(), level_sizes[level], i);
+            void* node = get_page(pager, page_num);
+            initialize_internal_node(node);
+            bool is_root = level + 1 == num_levels;
+            set_node_root(node, is_root);
+            *node_parent(node) = is_root ? 0 : first_pages[level + 1] + share_owner(level_sizes[level], level_sizes[level + 1], i);
+            internal_node_write_entries(table->layout, node, children.data() + first_child, num_children);
+
+            InternalEntry entry = {page_num, children[first_child + num_children - 1].key, 0};
+            for (uint32_t child = first_child; child < first_child + num_children; child++) {
+                entry.count += children[child].count;
+            }
+            entries.push_back(entry);
+            first_child += num_children;
+        }
+    }
+}
+
+// Nodes for a level of `items` rows or children at about `target` a node.
+// There are enough that none holds more than `max_items`, and when there
+// is more than one, an even spread gives each at least half of
+// `max_items`, which no node type requires more of.
+static uint32_t bulk_level_size(uint32_t items, uint32_t max_items, uint32_t target) {
+    if (items <= max_items) {
+        return 1;
+    }
+    return std::max((items + max_items - 1) / max_items, items / target);
+}
+
+// An even spread of `total` items over `parts`: the first total % parts
+// parts take one item more than the rest.
+static uint32_t share_size(uint32_t total, uint32_t parts, uint32_t part) {
+    return total / parts + (part < total % parts ? 1 : 0);
+}
+
+// The part that item `item` falls in under that spread.
+static uint32_t share_owner(uint32_t total, uint32_t parts, uint32_t item) {
+    uint32_t size = total / parts;
+    uint32_t larger_parts = total % parts;
+    uint32_t boundary = larger_parts * (size + 1);
+    return item < boundary ? item / (size + 1) : larger_parts + (item - boundary) / size;
+}
+
+
+// Each node starts a new pager operation so printing a large tree cycles
+// through the buffer pool; `node` is fetched again after every recursion.
+void print_tree(Pager* pager, const NodeLayout& layout, uint32_t page_num, uint32_t indentation_level) {
+    pager_begin_operation(pager);
+    void* node = get_page_for_read(pager, page_num);
     uint32_t num_keys, child;
 
     auto indent = [&](uint32_t level) {
@@ -307,7 +1109,7 @@ void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
             printf("- leaf (size %d)\n", num_keys);
             for (uint32_t i = 0; i < num_keys; i++) {
                 indent(indentation_level + 1);
-                printf("- %d\n", *leaf_node_key(node, i));
+                printf("- %d\n", leaf_node_key(layout, node, i));
             }
             break;
         case NODE_INTERNAL:
@@ -316,12 +1118,13 @@ void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level) {
             printf("- internal (size %d)\n", num_keys);
             for (uint32_t i = 0; i < num_keys; i++) {
                 child = *internal_node_child(node, i);
-                print_tree(pager, child, indentation_level + 1);
+                print_tree(pager, layout, child, indentation_level + 1);
+                node = get_page_for_read(pager, page_num);
                 indent(indentation_level + 1);
-                printf("- key %d\n", *internal_node_key(node, i));
+                printf("- key %d\n", internal_node_key(node, i));
             }
             child = *internal_node_right_child(node);
-            print_tree(pager, child, indentation_level + 1);
+            print_tree(pager, layout, child, indentation_level + 1);
             break;
     }
 }
@@ -4,8 +4,9 @@
 #include "pager.h"
 #include "row.h"
 
-// Forward declaration to break circular dependency
+// Forward declarations to break circular dependency
 struct Table;
+struct Cursor;
 
 // --- B-Tree Node Representation ---
 enum NodeType { NODE_INTERNAL, NODE_LEAF };
@@ -24,38 +25,160 @@ const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET = INTERNAL_NODE_NUM_KEYS_OFFSET + INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_RIGHT_COUNT_OFFSET = INTERNAL_NODE_RIGHT_CHILD_OFFSET + INTERNAL_NODE_RIGHT_CHILD_SIZE;
+const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NODE_NUM_KEYS_SIZE + INTERNAL_NODE_RIGHT_CHILD_SIZE + INTERNAL_NODE_RIGHT_COUNT_SIZE;
 
 /* Internal Node Body Layout */
-const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+// Each cell holds a child's page number and how many rows live in its
+// subtree, which turns the tree into an order-statistic tree (rank and nth
+// in O(log n)). The keys follow the cells, packed by frame of reference in
+// lanes of 8, 16 or 32 bits, the narrowest that holds the node's key
+// range, as named by the width in front of the cells. Narrower lanes hold
+// each key's distance from a base, the smallest key, stored between the
+// cells and the lanes; 32-bit lanes hold the keys themselves. How many
+// cells fit depends on the lanes, so a node over a narrow range of keys,
+// as on the levels just above the leaves, has more children.
+const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t); // the widest lane
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
-const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
-const uint32_t INTERNAL_NODE_MAX_CELLS = 3;
+const uint32_t INTERNAL_NODE_COUNT_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_COUNT_SIZE;
+// In bits: 8, 16 or 32.
+const uint32_t INTERNAL_NODE_KEY_WIDTH_SIZE = sizeof(uint8_t);
+const uint32_t INTERNAL_NODE_KEY_WIDTH_OFFSET = INTERNAL_NODE_HEADER_SIZE;
+const uint32_t INTERNAL_NODE_CELLS_OFFSET = INTERNAL_NODE_KEY_WIDTH_OFFSET + INTERNAL_NODE_KEY_WIDTH_SIZE;
+const uint32_t INTERNAL_NODE_KEY_BASE_SIZE = sizeof(uint32_t);
 
 /* Leaf Node Header Layout */
 const uint32_t LEAF_NODE_NUM_CELLS_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NUM_CELLS_OFFSET = COMMON_NODE_HEADER_SIZE;
 const uint32_t LEAF_NODE_NEXT_LEAF_SIZE = sizeof(uint32_t);
 const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET = LEAF_NODE_NUM_CELLS_OFFSET + LEAF_NODE_NUM_CELLS_SIZE;
-const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE;
+// Leaves are linked both ways so a scan can run backwards from any row.
+const uint32_t LEAF_NODE_PREV_LEAF_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_PREV_LEAF_OFFSET = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
+const uint32_t LEAF_NODE_VALUES_START_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_VALUES_START_OFFSET = LEAF_NODE_PREV_LEAF_OFFSET + LEAF_NODE_PREV_LEAF_SIZE;
+const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_CELLS_SIZE + LEAF_NODE_NEXT_LEAF_SIZE +
+                                       LEAF_NODE_PREV_LEAF_SIZE + LEAF_NODE_VALUES_START_SIZE;
 
 /* Leaf Node Body Layout */
+// Keys and values are stored apart: the keys right after the header, then
+// the values starting at the offset recorded in the header. A search reads
+// only the keys, a few cache lines, instead of touching one cell per probe.
+// How the values are laid out is chosen per table:
+//
+//   row: one ROW_SIZE slot per cell, each row's columns together (NSM).
+//        Each row holds its own id, so the keys in front are only a search
+//        index, kept by frame of reference: a base, then every key's
+//        distance from it in lanes of 8, 16 or 32 bits, the narrowest that
+//        holds the leaf's key range. Dense ids pack one key per byte.
+//   pax: the rows still share the page, but each column gets its own
+//        minipage of fixed-size slots, one per cell, so a scan that reads
+//        one column touches only that column's bytes (PAX). The keys are
+//        the id minipage, whole, since cursors point into it, so a cell is
+//        4 bytes smaller.
+enum LeafLayout { LEAF_LAYOUT_ROW, LEAF_LAYOUT_PAX };
+
 const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
-const uint32_t LEAF_NODE_KEY_OFFSET = 0;
 const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
-const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
+// A row cell reserves the widest lane, so any key range fits.
 const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
-const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
-const uint32_t LEAF_NODE_MIN_CELLS = LEAF_NODE_MAX_CELLS / 2;
+const uint32_t PAX_LEAF_NODE_CELL_SIZE = LEAF_NODE_CELL_SIZE - ID_SIZE;
+const uint32_t LEAF_NODE_KEY_BASE_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_KEY_BASE_OFFSET = LEAF_NODE_HEADER_SIZE;
+// In bits: 8, 16 or 32.
+const uint32_t LEAF_NODE_KEY_WIDTH_SIZE = sizeof(uint8_t);
+const uint32_t LEAF_NODE_KEY_WIDTH_OFFSET = LEAF_NODE_KEY_BASE_OFFSET + LEAF_NODE_KEY_BASE_SIZE;
+const uint32_t LEAF_NODE_KEY_DELTAS_OFFSET = LEAF_NODE_KEY_WIDTH_OFFSET + LEAF_NODE_KEY_WIDTH_SIZE;
+// Searches of packed keys binary-search down to this many, then scan them
+// with SIMD compares.
+const uint32_t PACKED_KEYS_SCAN_LANES = 16;
+
+// Cells an internal node holds when its keys take `lane_size` bytes each.
+// With 32-bit lanes that is as many as before keys were packed, at every
+// page size.
+inline uint32_t internal_node_max_cells(uint32_t page_size, uint32_t lane_size) {
+    uint32_t base_size = lane_size < INTERNAL_NODE_KEY_SIZE ? INTERNAL_NODE_KEY_BASE_SIZE : 0;
+    return (page_size - INTERNAL_NODE_CELLS_OFFSET - base_size) / (INTERNAL_NODE_CELL_SIZE + lane_size);
+}
+
+/* Node Capacities */
+// How many cells fit in a node depends on the page size, which is chosen
+// when the database is created, so the capacities are derived at open time.
+struct NodeLayout {
+    uint32_t page_size;
+    LeafLayout leaf_layout;
+    uint32_t leaf_max_cells;
+    uint32_t leaf_min_cells;
+    uint32_t leaf_left_split_count;
+    uint32_t leaf_right_split_count;
+    // With 32-bit key lanes, which any node can use; narrower lanes fit
+    // more (see internal_node_max_cells).
+    uint32_t internal_max_cells;
+    // A non-root internal node must keep at least this many children.
+    uint32_t internal_min_children;
+    // Column c of leaf cell i is at column_start[c] + i * column_stride[c]
+    // bytes into the page.
+    uint32_t column_start[UsersSchema::num_columns];
+    uint32_t column_stride[UsersSchema::num_columns];
+    // Where the values begin, as recorded in every leaf's header.
+    uint32_t leaf_values_start;
+};
+
+inline NodeLayout node_layout(uint32_t page_size, LeafLayout leaf_layout) {
+    NodeLayout layout;
+    layout.page_size = page_size;
+    layout.leaf_layout = leaf_layout;
+    uint32_t keys_start = leaf_layout == LEAF_LAYOUT_PAX ? LEAF_NODE_HEADER_SIZE : LEAF_NODE_KEY_DELTAS_OFFSET;
+    uint32_t cell_size = leaf_layout == LEAF_LAYOUT_PAX ? PAX_LEAF_NODE_CELL_SIZE : LEAF_NODE_CELL_SIZE;
+    layout.leaf_max_cells = (page_size - keys_start) / cell_size;
+    layout.leaf_min_cells = layout.leaf_max_cells / 2;
+    layout.leaf_right_split_count = (layout.leaf_max_cells + 1) / 2;
+    layout.leaf_left_split_count = (layout.leaf_max_cells + 1) - layout.leaf_right_split_count;
+    layout.internal_max_cells = internal_node_max_cells(page_size, INTERNAL_NODE_KEY_SIZE);
+    layout.internal_min_children = (layout.internal_max_cells + 2) / 2;
+
+    uint32_t values_start = keys_start + layout.leaf_max_cells * LEAF_NODE_KEY_SIZE;
+    layout.leaf_values_start = values_start;
+    for (uint32_t column = 0; column < UsersSchema::num_columns; column++) {
+        if (leaf_layout == LEAF_LAYOUT_ROW) {
+            layout.column_start[column] = values_start + UsersSchema::offsets[column];
+            layout.column_stride[column] = ROW_SIZE;
+        } else if (column == USERS_COLUMN_ID) {
+            layout.column_start[column] = LEAF_NODE_HEADER_SIZE;
+            layout.column_stride[column] = LEAF_NODE_KEY_SIZE;
+        } else {
+            layout.column_start[column] = values_start;
+            layout.column_stride[column] = UsersSchema::sizes[column];
+            values_start += layout.leaf_max_cells * UsersSchema::sizes[column];
+        }
+    }
+    return layout;
+}
 
 
 // --- B-Tree Function Declarations ---
-void initialize_leaf_node(void* node);
+void initialize_leaf_node(void* node, const NodeLayout& layout);
+void leaf_node_index_keys(const NodeLayout& layout, void* node);
+void leaf_node_index_insert(const NodeLayout& layout, void* node, uint32_t cell_num);
+void leaf_node_index_remove(const NodeLayout& layout, void* node, uint32_t cell_num);
 void initialize_internal_node(void* node);
+bool parse_leaf_layout(const std::string& name, LeafLayout* leaf_layout);
+const char* leaf_layout_name(LeafLayout leaf_layout);
 void leaf_node_insert(Table* table, uint32_t page_num, uint32_t cell_num, uint32_t key, Row* value);
+void leaf_node_insert_batch(Table* table, uint32_t page_num, Row* const* rows, uint32_t num_rows);
 void btree_delete(Table* table, uint32_t page_num, uint32_t cell_num, uint32_t key);
-void print_tree(Pager* pager, uint32_t page_num, uint32_t indentation_level);
+void btree_adjust_counts(Table* table, uint32_t key, int32_t delta);
+uint32_t btree_delete_range(Table* table, uint32_t page_num, uint32_t height, uint32_t start_key, uint32_t end_key);
+void btree_rebalance_path(Table* table, uint32_t key);
+void btree_truncate(Table* table, uint32_t height);
+void btree_bulk_load(Table* table, Cursor* source, uint32_t num_rows, uint32_t fill_percent);
+void btree_pack_internal_keys(Table* table);
+uint32_t node_row_count(void* node);
+uint32_t internal_node_find_child(void* node, uint32_t key);
+uint32_t packed_keys_lower_bound(const char* lanes, uint32_t lane_size, uint32_t base, uint32_t count, uint32_t key);
+void print_tree(Pager* pager, const NodeLayout& layout, uint32_t page_num, uint32_t indentation_level);
 
 
 // --- Accessor Functions (inline for performance) ---
@@ -78,17 +201,70 @@ inline uint32_t* node_parent(void* node) {
 inline uint32_t* leaf_node_next_leaf(void* node) {
     return (uint32_t*)((char*)node + LEAF_NODE_NEXT_LEAF_OFFSET);
 }
+inline uint32_t* leaf_node_prev_leaf(void* node) {
+    return (uint32_t*)((char*)node + LEAF_NODE_PREV_LEAF_OFFSET);
+}
 inline uint32_t* leaf_node_num_cells(void* node) {
     return (uint32_t*)((char*)node + LEAF_NODE_NUM_CELLS_OFFSET);
 }
-inline void* leaf_node_cell(void* node, uint32_t cell_num) {
-    return (char*)node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE;
+inline uint32_t* leaf_node_values_start(void* node) {
+    return (uint32_t*)((char*)node + LEAF_NODE_VALUES_START_OFFSET);
+}
+inline uint32_t* leaf_node_key_base(void* node) {
+    return (uint32_t*)((char*)node + LEAF_NODE_KEY_BASE_OFFSET);
+}
+inline uint8_t* leaf_node_key_width(void* node) {
+    return (uint8_t*)((char*)node + LEAF_NODE_KEY_WIDTH_OFFSET);
+}
+inline char* leaf_node_key_deltas(void* node) {
+    return (char*)node + LEAF_NODE_KEY_DELTAS_OFFSET;
+}
+inline char* leaf_node_column(const NodeLayout& layout, void* node, uint32_t cell_num, uint32_t column) {
+    return (char*)node + layout.column_start[column] + cell_num * layout.column_stride[column];
+}
+// A cell's key is its row's id, read from the row itself: the packed keys
+// of a row leaf are for searching, and are rebuilt from the ids whenever
+// cells change.
+inline uint32_t leaf_node_key(const NodeLayout& layout, void* node, uint32_t cell_num) {
+    return UsersSchema::Column<USERS_COLUMN_ID>::read(leaf_node_column(layout, node, cell_num, USERS_COLUMN_ID));
+}
+// A view of the cell's row. Nothing is read until an accessor is called,
+// and then only that column.
+inline RowView leaf_node_row(const NodeLayout& layout, void* node, uint32_t cell_num) {
+    RowView row;
+    for (uint32_t column = 0; column < UsersSchema::num_columns; column++) {
+        row.columns[column] = leaf_node_column(layout, node, cell_num, column);
+    }
+    return row;
+}
+inline void leaf_node_write_row(const NodeLayout& layout, void* node, uint32_t cell_num, const Row* row) {
+    char* slots[UsersSchema::num_columns];
+    for (uint32_t column = 0; column < UsersSchema::num_columns; column++) {
+        slots[column] = leaf_node_column(layout, node, cell_num, column);
+    }
+    UsersSchema::scatter(slots, row->id, row->username, row->email);
 }
-inline uint32_t* leaf_node_key(void* node, uint32_t cell_num) {
-    return (uint32_t*)leaf_node_cell(node, cell_num);
+// Copies a row from another cell, or from a serialized row, slot by slot.
+inline void leaf_node_copy_row(const NodeLayout& layout, void* node, uint32_t cell_num, const RowView& row) {
+    for (uint32_t column = 0; column < UsersSchema::num_columns; column++) {
+        memcpy(leaf_node_column(layout, node, cell_num, column), row.columns[column], UsersSchema::sizes[column]);
+    }
 }
-inline void* leaf_node_value(void* node, uint32_t cell_num) {
-    return (char*)leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+// Copies `count` cells between leaves or within one leaf; the ranges may
+// overlap. A row leaf's packed keys are not moved: the caller rebuilds them
+// once the cell counts are final.
+inline void leaf_node_move_cells(const NodeLayout& layout, void* destination, uint32_t destination_cell, void* source,
+                                 uint32_t source_cell, uint32_t count) {
+    if (layout.leaf_layout == LEAF_LAYOUT_ROW) {
+        memmove(leaf_node_column(layout, destination, destination_cell, USERS_COLUMN_ID),
+                leaf_node_column(layout, source, source_cell, USERS_COLUMN_ID), count * LEAF_NODE_VALUE_SIZE);
+        return;
+    }
+    // The keys are the id minipage and move with the other columns.
+    for (uint32_t column = USERS_COLUMN_ID; column < UsersSchema::num_columns; column++) {
+        memmove(leaf_node_column(layout, destination, destination_cell, column),
+                leaf_node_column(layout, source, source_cell, column), count * UsersSchema::sizes[column]);
+    }
 }
 inline uint32_t* internal_node_num_keys(void* node) {
     return (uint32_t*)((char*)node + INTERNAL_NODE_NUM_KEYS_OFFSET);
@@ -96,11 +272,32 @@ inline uint32_t* internal_node_num_keys(void* node) {
 inline uint32_t* internal_node_right_child(void* node) {
     return (uint32_t*)((char*)node + INTERNAL_NODE_RIGHT_CHILD_OFFSET);
 }
+inline uint8_t* internal_node_key_width(void* node) {
+    return (uint8_t*)((char*)node + INTERNAL_NODE_KEY_WIDTH_OFFSET);
+}
 inline uint32_t* internal_node_cell(void* node, uint32_t cell_num) {
-    return (uint32_t*)((char*)node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE);
+    return (uint32_t*)((char*)node + INTERNAL_NODE_CELLS_OFFSET + cell_num * INTERNAL_NODE_CELL_SIZE);
+}
+// The base and the lanes start right after the last cell, so they move
+// whenever the number of keys changes; nodes are rewritten whole when it
+// does. Keys are read only here and change through
+// internal_node_write_entries, which repacks them.
+inline uint32_t internal_node_key_base(void* node) {
+    uint32_t base = 0;
+    if (*internal_node_key_width(node) / 8 < INTERNAL_NODE_KEY_SIZE) {
+        memcpy(&base, internal_node_cell(node, *internal_node_num_keys(node)), INTERNAL_NODE_KEY_BASE_SIZE);
+    }
+    return base;
 }
-inline uint32_t* internal_node_key(void* node, uint32_t key_num) {
-    return (uint32_t*)((char*)internal_node_cell(node, key_num) + INTERNAL_NODE_CHILD_SIZE);
+inline char* internal_node_key_lanes(void* node) {
+    uint32_t base_size = *internal_node_key_width(node) / 8 < INTERNAL_NODE_KEY_SIZE ? INTERNAL_NODE_KEY_BASE_SIZE : 0;
+    return (char*)internal_node_cell(node, *internal_node_num_keys(node)) + base_size;
+}
+inline uint32_t internal_node_key(void* node, uint32_t key_num) {
+    uint32_t lane_size = *internal_node_key_width(node) / 8;
+    uint32_t delta = 0; // lanes are little-endian, as is every integer in the file
+    memcpy(&delta, internal_node_key_lanes(node) + key_num * lane_size, lane_size);
+    return internal_node_key_base(node) + delta;
 }
 inline uint32_t* internal_node_child(void* node, uint32_t child_num) {
     uint32_t num_keys = *internal_node_num_keys(node);
@@ -113,4 +310,15 @@ inline uint32_t* internal_node_child(void* node, uint32_t child_num) {
         return (uint32_t*)internal_node_cell(node, child_num);
     }
 }
+inline uint32_t* internal_node_child_count(void* node, uint32_t child_num) {
+    uint32_t num_keys = *internal_node_num_keys(node);
+    if (child_num > num_keys) {
+        std::cerr << "Tried to access count of child_num " << child_num << " > num_keys " << num_keys << std::endl;
+        exit(EXIT_FAILURE);
+    } else if (child_num == num_keys) {
+        return (uint32_t*)((char*)node + INTERNAL_NODE_RIGHT_COUNT_OFFSET);
+    } else {
+        return (uint32_t*)((char*)internal_node_cell(node, child_num) + INTERNAL_NODE_CHILD_SIZE);
+    }
+}
 #endif // BTREE_H
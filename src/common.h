@@ -14,7 +14,12 @@
 
 
 // Project-wide constants
-const uint32_t PAGE_SIZE = 4096;
-const uint32_t TABLE_MAX_PAGES = 100;
+// Page size for new databases; any power of two in [MIN_PAGE_SIZE,
+// MAX_PAGE_SIZE] can be chosen at creation and is recorded in the file.
+const uint32_t DEFAULT_PAGE_SIZE = 4096;
+const uint32_t MIN_PAGE_SIZE = 4096;
+const uint32_t MAX_PAGE_SIZE = 65536;
+// Memory the buffer pool fills before it starts evicting pages.
+const uint32_t PAGER_CACHE_BYTES = 16 * 1024 * 1024;
 
 #endif // COMMON_H
\ No newline at end of file
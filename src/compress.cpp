@@ -0,0 +1,141 @@
+#include "compress.h"
+#include <algorithm>
+
+static bool lz_emit(char* destination, uint32_t capacity, uint32_t* out, const char* literals, uint32_t literal_length,
+                    uint32_t offset, uint32_t match_length);
+static void lz_write_length(char* destination, uint32_t* out, uint32_t length);
+static bool lz_read_length(const uint8_t** in, const uint8_t* in_end, uint32_t* length);
+
+
+// Greedy single-pass matcher: a hash of the next four bytes finds the last
+// position that started with the same hash, and a match is taken whenever
+// those bytes really are equal and within reach of a 16-bit offset.
+uint32_t lz_compress(const char* source, uint32_t length, char* destination, uint32_t capacity) {
+    uint32_t table[1 << LZ_HASH_BITS] = {}; // position + 1 of the last sequence per hash; 0 = none
+    uint32_t position = 0;
+    uint32_t anchor = 0;
+    uint32_t out = 0;
+    while (position + LZ_MIN_MATCH <= length) {
+        uint32_t sequence;
+        memcpy(&sequence, source + position, sizeof(sequence));
+        uint32_t hash = (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+        uint32_t candidate = table[hash];
+        table[hash] = position + 1;
+        if (candidate == 0 || position - (candidate - 1) > LZ_MAX_OFFSET ||
+            memcmp(source + candidate - 1, source + position, LZ_MIN_MATCH) != 0) {
+            position++;
+            continue;
+        }
+
+        uint32_t match = candidate - 1;
+        uint32_t match_length = LZ_MIN_MATCH;
+        while (position + match_length < length && source[match + match_length] == source[position + match_length]) {
+            match_length++;
+        }
+        if (!lz_emit(destination, capacity, &out, source + anchor, position - anchor, position - match, match_length)) {
+            return 0;
+        }
+        position += match_length;
+        anchor = position;
+    }
+    // The last sequence carries only literals.
+    if (!lz_emit(destination, capacity, &out, source + anchor, length - anchor, 0, 0)) {
+        return 0;
+    }
+    return out;
+}
+
+bool lz_decompress(const char* source, uint32_t compressed_length, char* destination, uint32_t length) {
+    const uint8_t* in = (const uint8_t*)source;
+    const uint8_t* in_end = in + compressed_length;
+    uint32_t out = 0;
+    while (in < in_end) {
+        uint8_t token = *in++;
+        uint32_t literal_length = token >> 4;
+        if (literal_length == 15 && !lz_read_length(&in, in_end, &literal_length)) {
+            return false;
+        }
+        if (literal_length > (uint32_t)(in_end - in) || literal_length > length - out) {
+            return false;
+        }
+        memcpy(destination + out, in, literal_length);
+        in += literal_length;
+        out += literal_length;
+        if (in == in_end) {
+            break;
+        }
+
+        if (in_end - in < 2) {
+            return false;
+        }
+        uint32_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        uint32_t match_length = token & 15;
+        if (match_length == 15 && !lz_read_length(&in, in_end, &match_length)) {
+            return false;
+        }
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > out || match_length > length - out) {
+            return false;
+        }
+        if (offset >= match_length) {
+            memcpy(destination + out, destination + out - offset, match_length);
+        } else {
+            // Overlapping match (a run): copy forward one byte at a time.
+            for (uint32_t i = 0; i < match_length; i++) {
+                destination[out + i] = destination[out - offset + i];
+            }
+        }
+        out += match_length;
+    }
+    return out == length;
+}
+
+// Appends one sequence; a match_length of 0 marks the final, literal-only one.
+static bool lz_emit(char* destination, uint32_t capacity, uint32_t* out, const char* literals, uint32_t literal_length,
+                    uint32_t offset, uint32_t match_length) {
+    uint32_t needed = 1 + literal_length / 255 + 1 + literal_length;
+    if (match_length > 0) {
+        needed += 2 + (match_length - LZ_MIN_MATCH) / 255 + 1;
+    }
+    if (*out + needed > capacity) {
+        return false;
+    }
+
+    uint32_t literal_code = std::min<uint32_t>(literal_length, 15);
+    uint32_t match_code = match_length > 0 ? std::min<uint32_t>(match_length - LZ_MIN_MATCH, 15) : 0;
+    destination[(*out)++] = (char)((literal_code << 4) | match_code);
+    if (literal_length >= 15) {
+        lz_write_length(destination, out, literal_length - 15);
+    }
+    memcpy(destination + *out, literals, literal_length);
+    *out += literal_length;
+    if (match_length > 0) {
+        destination[(*out)++] = (char)(offset & 0xFF);
+        destination[(*out)++] = (char)(offset >> 8);
+        if (match_length - LZ_MIN_MATCH >= 15) {
+            lz_write_length(destination, out, match_length - LZ_MIN_MATCH - 15);
+        }
+    }
+    return true;
+}
+
+static void lz_write_length(char* destination, uint32_t* out, uint32_t length) {
+    while (length >= 255) {
+        destination[(*out)++] = (char)255;
+        length -= 255;
+    }
+    destination[(*out)++] = (char)length;
+}
+
+static bool lz_read_length(const uint8_t** in, const uint8_t* in_end, uint32_t* length) {
+    uint8_t byte;
+    do {
+        if (*in == in_end) {
+            return false;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
@@ -0,0 +1,29 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include "common.h"
+
+// --- Page Compression Codec ---
+// A small LZ77 codec in the LZ4 block format: each sequence is a token
+// (literal length in the high nibble, match length - 4 in the low nibble),
+// the literals, and a 2-byte little-endian match offset, with lengths of 15
+// or more continued in extra bytes. It is fast enough to run on every page
+// read and write, and the NUL padding of fixed-size rows shrinks to a few
+// bytes per run.
+const uint32_t LZ_MIN_MATCH = 4;
+const uint32_t LZ_MAX_OFFSET = 65535;
+const uint32_t LZ_HASH_BITS = 12;
+
+// Worst-case output size for `length` input bytes, for sizing buffers.
+inline uint32_t lz_compress_bound(uint32_t length) {
+    return length + length / 255 + 16;
+}
+
+// Returns the compressed size, or 0 when the output would not fit in
+// `capacity` bytes.
+uint32_t lz_compress(const char* source, uint32_t length, char* destination, uint32_t capacity);
+// Returns false if the input is corrupt or does not decode to exactly
+// `length` bytes.
+bool lz_decompress(const char* source, uint32_t compressed_length, char* destination, uint32_t length);
+
+#endif // COMPRESS_H
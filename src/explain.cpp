@@ -0,0 +1,157 @@
+#include "explain.h"
+#include "pager.h"
+#include "btree.h"
+
+// Only this many pages are listed individually; the totals cover all.
+const uint32_t EXPLAIN_MAX_LISTED_PAGES = 32;
+
+static const char* PHASE_NAMES[NUM_EXPLAIN_PHASES] = {"descend", "modify", "split", "rebalance", "scan"};
+
+// A page's role as of the end of the statement.
+static const char* page_kind(const PageAccess& access) {
+    if (access.page_num == DB_HEADER_PAGE_NUM) {
+        return "header";
+    }
+    if (access.on_free_list) {
+        return "free";
+    }
+    if (!access.node_type_known) {
+        return "node";
+    }
+    return access.node_type == NODE_LEAF ? "leaf" : "internal";
+}
+
+// Every duration is printed in microseconds.
+static void print_duration(std::ostream& out, uint64_t nanoseconds) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.1fus", nanoseconds / 1000.0);
+    out << text;
+}
+
+
+ExplainTrace* explain_begin(Pager* pager) {
+    ExplainTrace* trace = new ExplainTrace();
+    for (uint32_t i = 0; i < NUM_METRIC_COUNTERS; i++) {
+        trace->counters_before[i] = metrics_counter((MetricCounter)i);
+    }
+    trace->start_ns = metrics_now_ns();
+    trace->phase = PHASE_DESCEND;
+    trace->phase_start_ns = trace->start_ns;
+    pager->trace = trace;
+    return trace;
+}
+
+// Stops the clock and the counters, then settles each page's node type
+// from the copy still in the buffer pool, if there is one. Roots change
+// type when they split or collapse, and new pages are typed only after
+// they are fetched.
+void explain_end(Pager* pager) {
+    ExplainTrace* trace = pager->trace;
+    uint64_t now = metrics_now_ns();
+    trace->phase_ns[trace->phase] += now - trace->phase_start_ns;
+    trace->total_ns = now - trace->start_ns;
+    for (uint32_t i = 0; i < NUM_METRIC_COUNTERS; i++) {
+        trace->counters_delta[i] = metrics_counter((MetricCounter)i) - trace->counters_before[i];
+    }
+    pager->trace = nullptr;
+
+    for (PageAccess& access : trace->pages) {
+        void* page = access.on_free_list ? nullptr : pager_cached_page(pager, access.page_num);
+        if (page != nullptr) {
+            access.node_type = get_node_type(page);
+            access.node_type_known = true;
+        }
+    }
+}
+
+void explain_switch_phase(ExplainTrace* trace, ExplainPhase phase) {
+    uint64_t now = metrics_now_ns();
+    trace->phase_ns[trace->phase] += now - trace->phase_start_ns;
+    trace->phase = phase;
+    trace->phase_start_ns = now;
+}
+
+// Called by get_page for every fetch. A page read from the file already
+// holds its node; a new one is all zeros until its caller initializes it.
+void explain_record_page(ExplainTrace* trace, uint32_t page_num, void* page, bool hit, bool allocated, bool for_write) {
+    trace->total_fetches++;
+    auto found = trace->page_index.find(page_num);
+    if (found == trace->page_index.end()) {
+        if (!hit) {
+            trace->misses++;
+        }
+        PageAccess access = {page_num, hit, allocated, 0, false, false, false, 0};
+        found = trace->page_index.emplace(page_num, trace->pages.size()).first;
+        trace->pages.push_back(access);
+    }
+    PageAccess& access = trace->pages[found->second];
+    access.fetches++;
+    access.dirtied = access.dirtied || for_write || allocated;
+    access.on_free_list = access.on_free_list || trace->in_free_list;
+    if (!allocated && !access.on_free_list) {
+        access.node_type = get_node_type(page);
+        access.node_type_known = true;
+    }
+}
+
+// Only pages the statement fetched are tracked; a subtree freed without
+// being read never appears in the report.
+void explain_record_free_list(ExplainTrace* trace, uint32_t page_num, bool on_free_list) {
+    auto found = trace->page_index.find(page_num);
+    if (found != trace->page_index.end()) {
+        trace->pages[found->second].on_free_list = on_free_list;
+        if (!on_free_list) {
+            trace->pages[found->second].node_type_known = false;
+        }
+    }
+}
+
+void explain_print(ExplainTrace* trace, std::ostream& out) {
+    out << "Explain analyze:" << std::endl;
+
+    for (const std::vector<uint32_t>& path : trace->paths) {
+        out << "  Search path:";
+        for (size_t i = 0; i < path.size(); i++) {
+            auto found = trace->page_index.find(path[i]);
+            out << (i == 0 ? " " : " -> ") << path[i] << " ("
+                << (found != trace->page_index.end() ? page_kind(trace->pages[found->second]) : "node") << ")";
+        }
+        out << std::endl;
+    }
+
+    uint32_t num_dirtied = 0;
+    for (const PageAccess& access : trace->pages) {
+        num_dirtied += access.dirtied;
+    }
+
+    out << "  Pages fetched: " << trace->total_fetches << " (" << trace->pages.size() << " distinct, "
+        << trace->misses << " cache misses, " << num_dirtied << " dirtied)" << std::endl;
+    for (size_t i = 0; i < trace->pages.size() && i < EXPLAIN_MAX_LISTED_PAGES; i++) {
+        const PageAccess& access = trace->pages[i];
+        out << "    page " << access.page_num << " " << page_kind(access)
+            << ": " << access.fetches << " fetches, " << (access.allocated ? "new" : (access.first_access_hit ? "hit" : "miss"))
+            << (access.dirtied ? ", dirtied" : "") << std::endl;
+    }
+    if (trace->pages.size() > EXPLAIN_MAX_LISTED_PAGES) {
+        out << "    ... " << trace->pages.size() - EXPLAIN_MAX_LISTED_PAGES << " more pages" << std::endl;
+    }
+
+    const uint64_t* delta = trace->counters_delta;
+    out << "  Structure: " << delta[METRIC_LEAF_SPLITS] << " leaf splits, " << delta[METRIC_INTERNAL_SPLITS]
+        << " internal splits, " << delta[METRIC_ROOT_SPLITS] << " root splits, " << delta[METRIC_LEAF_MERGES]
+        << " leaf merges, " << delta[METRIC_INTERNAL_MERGES] << " internal merges, "
+        << delta[METRIC_LEAF_BORROWS] + delta[METRIC_INTERNAL_BORROWS] << " borrows, "
+        << delta[METRIC_ROOT_COLLAPSES] << " root collapses" << std::endl;
+
+    out << "  Time:";
+    for (uint32_t i = 0; i < NUM_EXPLAIN_PHASES; i++) {
+        if (trace->phase_ns[i] > 0) {
+            out << " " << PHASE_NAMES[i] << " ";
+            print_duration(out, trace->phase_ns[i]);
+            out << ",";
+        }
+    }
+    out << " total ";
+    print_duration(out, trace->total_ns);
+    out << std::endl;
+}
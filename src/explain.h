@@ -0,0 +1,95 @@
+#ifndef EXPLAIN_H
+#define EXPLAIN_H
+
+#include "common.h"
+#include "metrics.h"
+#include <unordered_map>
+
+// --- EXPLAIN ANALYZE Tracing ---
+// While a statement runs under "explain analyze", the pager points at an
+// ExplainTrace and every page fetch, descent step and phase change is
+// recorded. Outside of explain the pointer is null and each hook costs one
+// branch. Everything the report says about a page is captured while the
+// statement runs or read from the buffer pool as it ends, never fetched
+// afterwards, so the tracer adds no I/O and no buffer-pool metrics of its
+// own, and never touches a page the statement freed.
+
+enum ExplainPhase {
+    PHASE_DESCEND,   // root-to-leaf searches
+    PHASE_MODIFY,    // editing the target leaf and subtree counts
+    PHASE_SPLIT,     // leaf/internal splits and new roots
+    PHASE_REBALANCE, // borrows, merges and root collapses after a delete
+    PHASE_SCAN,      // walking leaves and producing rows
+    NUM_EXPLAIN_PHASES
+};
+
+struct PageAccess {
+    uint32_t page_num;
+    bool first_access_hit;
+    bool allocated;
+    uint32_t fetches;
+    // Fetched for writing at least once, which marks the page dirty.
+    bool dirtied;
+    // Freed, or fetched as part of the free list, and not handed out again.
+    bool on_free_list;
+    // The node type as of the end of the statement, once known; a page
+    // allocated and never seen again after it was initialized has none.
+    bool node_type_known;
+    uint8_t node_type;
+};
+
+struct ExplainTrace {
+    std::vector<PageAccess> pages;            // in order of first access
+    std::unordered_map<uint32_t, uint32_t> page_index;
+    std::vector<std::vector<uint32_t>> paths; // one per descent
+    uint64_t total_fetches;
+    uint64_t misses;
+    // Set while the pager works on the free list.
+    bool in_free_list;
+
+    ExplainPhase phase;
+    uint64_t phase_start_ns;
+    uint64_t phase_ns[NUM_EXPLAIN_PHASES];
+    uint64_t start_ns;
+    uint64_t total_ns;
+    uint64_t counters_before[NUM_METRIC_COUNTERS];
+    uint64_t counters_delta[NUM_METRIC_COUNTERS];
+};
+
+struct Pager;
+
+ExplainTrace* explain_begin(Pager* pager);
+void explain_end(Pager* pager);
+void explain_print(ExplainTrace* trace, std::ostream& out);
+void explain_record_page(ExplainTrace* trace, uint32_t page_num, void* page, bool hit, bool allocated, bool for_write);
+void explain_record_free_list(ExplainTrace* trace, uint32_t page_num, bool on_free_list);
+void explain_switch_phase(ExplainTrace* trace, ExplainPhase phase);
+
+inline void explain_phase(ExplainTrace* trace, ExplainPhase phase) {
+    if (trace != nullptr) {
+        explain_switch_phase(trace, phase);
+    }
+}
+inline void explain_free_list(ExplainTrace* trace, bool active) {
+    if (trace != nullptr) {
+        trace->in_free_list = active;
+    }
+}
+// A page was freed (true) or taken off the free list for reuse (false).
+inline void explain_page_freed(ExplainTrace* trace, uint32_t page_num, bool on_free_list) {
+    if (trace != nullptr) {
+        explain_record_free_list(trace, page_num, on_free_list);
+    }
+}
+inline void explain_begin_descent(ExplainTrace* trace) {
+    if (trace != nullptr) {
+        trace->paths.push_back(std::vector<uint32_t>());
+    }
+}
+inline void explain_path_step(ExplainTrace* trace, uint32_t page_num) {
+    if (trace != nullptr && !trace->paths.empty()) {
+        trace->paths.back().push_back(page_num);
+    }
+}
+
+#endif // EXPLAIN_H
@@ -0,0 +1,386 @@
+#include "io.h"
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+// The rings io_uring_setup shares with the kernel; there is no liburing
+// dependency, the three mappings are set up by hand.
+struct UringQueue {
+    int ring_fd;
+    uint32_t entries;
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    uint32_t* sq_tail;
+    uint32_t* sq_mask;
+    uint32_t* sq_array;
+    uint32_t* cq_head;
+    uint32_t* cq_tail;
+    uint32_t* cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+struct IoQueue {
+    int file_descriptor;
+    IoBackend backend;
+    uint32_t in_flight;
+
+    UringQueue uring;
+
+    // Requests not yet handed to the kernel or a worker: with io_uring the
+    // ones that did not fit in the ring, refilled as completions are reaped.
+    std::deque<IoRequest*> pending;
+
+    // Thread-pool fallback; in_flight and pending are guarded by `mutex` in
+    // this mode.
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    bool stopping;
+};
+
+static bool uring_open(UringQueue* ring, uint32_t entries);
+static void uring_close(UringQueue* ring);
+static void uring_submit(IoQueue* queue);
+static void uring_reap(IoQueue* queue, bool wait);
+static void io_worker(IoQueue* queue);
+static int64_t io_transfer_sync(int file_descriptor, IoRequest* request, uint64_t done);
+
+
+IoQueue* io_queue_open(int file_descriptor, IoBackend backend) {
+    IoQueue* queue = new IoQueue();
+    queue->file_descriptor = file_descriptor;
+    queue->in_flight = 0;
+    queue->stopping = false;
+
+    // io_uring may be compiled out or blocked by a seccomp profile; the
+    // thread pool gives the same interface everywhere.
+    if (backend != IO_BACKEND_THREADS && uring_open(&queue->uring, IO_QUEUE_DEPTH)) {
+        queue->backend = IO_BACKEND_URING;
+        return queue;
+    }
+    queue->backend = IO_BACKEND_THREADS;
+    for (uint32_t i = 0; i < IO_THREAD_POOL_SIZE; i++) {
+        queue->threads.emplace_back(io_worker, queue);
+    }
+    return queue;
+}
+
+void io_queue_close(IoQueue* queue) {
+    io_wait_all(queue);
+    if (queue->backend == IO_BACKEND_URING) {
+        uring_close(&queue->uring);
+    } else {
+        {
+            std::lock_guard<std::mutex> lock(queue->mutex);
+            queue->stopping = true;
+        }
+        queue->work_ready.notify_all();
+        for (std::thread& thread : queue->threads) {
+            thread.join();
+        }
+    }
+    delete queue;
+}
+
+IoBackend io_queue_backend(IoQueue* queue) {
+    return queue->backend;
+}
+
+bool parse_io_backend(const std::string& name, IoBackend* backend) {
+    if (name == "auto") {
+        *backend = IO_BACKEND_AUTO;
+    } else if (name == "uring") {
+        *backend = IO_BACKEND_URING;
+    } else if (name == "threads") {
+        *backend = IO_BACKEND_THREADS;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* io_backend_name(IoBackend backend) {
+    switch (backend) {
+        case IO_BACKEND_URING:
+            return "uring";
+        case IO_BACKEND_THREADS:
+            return "threads";
+        default:
+            return "auto";
+    }
+}
+
+// Queues every request without waiting for any of them.
+void io_submit(IoQueue* queue, IoRequest* const* requests, uint32_t num_requests) {
+    if (num_requests == 0) {
+        return;
+    }
+    if (queue->backend == IO_BACKEND_URING) {
+        queue->pending.insert(queue->pending.end(), requests, requests + num_requests);
+        uring_submit(queue);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        for (uint32_t i = 0; i < num_requests; i++) {
+            queue->pending.push_back(requests[i]);
+        }
+        queue->in_flight += num_requests;
+    }
+    queue->work_ready.notify_all();
+}
+
+void io_wait(IoQueue* queue, IoRequest* request) {
+    if (queue->backend == IO_BACKEND_URING) {
+        while (!request->completed) {
+            uring_reap(queue, true);
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    queue->work_done.wait(lock, [request] { return request->completed.load(); });
+}
+
+void io_wait_all(IoQueue* queue) {
+    if (queue->backend == IO_BACKEND_URING) {
+        while (queue->in_flight > 0 || !queue->pending.empty()) {
+            uring_reap(queue, true);
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    queue->work_done.wait(lock, [queue] { return queue->in_flight == 0; });
+}
+
+// Picks up finished requests without blocking and moves queued ones into
+// the freed ring slots. Only io_uring needs this; pool threads mark their
+// requests completed and take new ones as they go.
+void io_poll(IoQueue* queue) {
+    if (queue->backend == IO_BACKEND_URING) {
+        uring_reap(queue, false);
+    }
+}
+
+uint32_t io_in_flight(IoQueue* queue) {
+    if (queue->backend == IO_BACKEND_URING) {
+        uring_reap(queue, false);
+        return queue->in_flight + queue->pending.size();
+    }
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    return queue->in_flight;
+}
+
+
+// --- io_uring ---
+
+static bool uring_open(UringQueue* ring, uint32_t entries) {
+    struct io_uring_params params = {};
+    int ring_fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring_fd < 0) {
+        return false;
+    }
+    *ring = {};
+    ring->ring_fd = ring_fd;
+    ring->entries = params.sq_entries;
+    ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        ring->sq_ring_size = std::max(ring->sq_ring_size, ring->cq_ring_size);
+        ring->cq_ring_size = ring->sq_ring_size;
+    }
+
+    ring->sq_ring = mmap(nullptr, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) {
+        ring->sq_ring = nullptr;
+        uring_close(ring);
+        return false;
+    }
+    if (single_mmap) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(nullptr, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) {
+            ring->cq_ring = nullptr;
+            uring_close(ring);
+            return false;
+        }
+    }
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        uring_close(ring);
+        return false;
+    }
+    ring->sqes = (struct io_uring_sqe*)sqes;
+
+    char* sq = (char*)ring->sq_ring;
+    char* cq = (char*)ring->cq_ring;
+    ring->sq_tail = (uint32_t*)(sq + params.sq_off.tail);
+    ring->sq_mask = (uint32_t*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (uint32_t*)(sq + params.sq_off.array);
+    ring->cq_head = (uint32_t*)(cq + params.cq_off.head);
+    ring->cq_tail = (uint32_t*)(cq + params.cq_off.tail);
+    ring->cq_mask = (uint32_t*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return true;
+}
+
+static void uring_close(UringQueue* ring) {
+    if (ring->sqes != nullptr) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ring != nullptr && ring->cq_ring != ring->sq_ring) {
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    }
+    if (ring->sq_ring != nullptr) {
+        munmap(ring->sq_ring, ring->sq_ring_size);
+    }
+    close(ring->ring_fd);
+}
+
+static int uring_enter(UringQueue* ring, uint32_t to_submit, uint32_t min_complete, uint32_t flags) {
+    return syscall(__NR_io_uring_enter, ring->ring_fd, to_submit, min_complete, flags, nullptr, 0);
+}
+
+// Moves queued requests into free SQEs and submits them with one
+// io_uring_enter. Whatever does not fit stays queued until uring_reap
+// frees ring slots, so submitting never blocks on the device.
+static void uring_submit(IoQueue* queue) {
+    UringQueue& ring = queue->uring;
+    uint32_t tail = *ring.sq_tail;
+    uint32_t batch = 0;
+    while (!queue->pending.empty() && queue->in_flight + batch < ring.entries) {
+        IoRequest* request = queue->pending.front();
+        queue->pending.pop_front();
+        uint32_t index = tail & *ring.sq_mask;
+        struct io_uring_sqe* sqe = &ring.sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = request->is_write ? IORING_OP_WRITEV : IORING_OP_READV;
+        sqe->fd = queue->file_descriptor;
+        sqe->off = request->offset;
+        sqe->addr = (uint64_t)(uintptr_t)request->iov.data();
+        sqe->len = request->iov.size();
+        sqe->user_data = (uint64_t)(uintptr_t)request;
+        ring.sq_array[index] = index;
+        tail++;
+        batch++;
+    }
+    if (batch == 0) {
+        return;
+    }
+    __atomic_store_n(ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+    // The completion ring has twice the slots of the submission ring, so
+    // with at most `entries` in flight it cannot overflow.
+    uint32_t submitted = 0;
+    while (submitted < batch) {
+        int result = uring_enter(&ring, batch - submitted, 0, 0);
+        if (result == -1 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if (result == -1) {
+            std::cerr << "Error submitting I/O: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        submitted += result;
+    }
+    queue->in_flight += batch;
+}
+
+static void uring_reap(IoQueue* queue, bool wait) {
+    UringQueue& ring = queue->uring;
+    if (wait) {
+        while (uring_enter(&ring, 0, 1, IORING_ENTER_GETEVENTS) == -1) {
+            if (errno != EINTR) {
+                std::cerr << "Error waiting for I/O: " << strerror(errno) << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    uint32_t head = *ring.cq_head;
+    uint32_t tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cq_mask];
+        IoRequest* request = (IoRequest*)(uintptr_t)cqe->user_data;
+        request->result = cqe->res;
+        // Short transfers (signals, EOF on reads) are finished synchronously.
+        if (request->result >= 0 && (uint64_t)request->result < request->length) {
+            request->result = io_transfer_sync(queue->file_descriptor, request, request->result);
+        }
+        request->completed = true;
+        queue->in_flight--;
+        head++;
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+    uring_submit(queue);
+}
+
+
+// --- Thread-Pool Fallback ---
+
+static void io_worker(IoQueue* queue) {
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    while (true) {
+        queue->work_ready.wait(lock, [queue] { return queue->stopping || !queue->pending.empty(); });
+        if (queue->pending.empty()) {
+            return;
+        }
+        IoRequest* request = queue->pending.front();
+        queue->pending.pop_front();
+        lock.unlock();
+        request->result = io_transfer_sync(queue->file_descriptor, request, 0);
+        lock.lock();
+        request->completed = true;
+        queue->in_flight--;
+        queue->work_done.notify_all();
+    }
+}
+
+// Performs the rest of a request with preadv/pwritev, starting `done` bytes
+// in. Reads that hit the end of the file zero-fill the remainder.
+static int64_t io_transfer_sync(int file_descriptor, IoRequest* request, uint64_t done) {
+    while (done < request->length) {
+        std::vector<struct iovec> remaining;
+        uint64_t skip = done;
+        for (const struct iovec& vector : request->iov) {
+            if (skip >= vector.iov_len) {
+                skip -= vector.iov_len;
+                continue;
+            }
+            remaining.push_back({(char*)vector.iov_base + skip, vector.iov_len - skip});
+            skip = 0;
+        }
+
+        off_t offset = request->offset + done;
+        ssize_t result = request->is_write ? pwritev(file_descriptor, remaining.data(), remaining.size(), offset)
+                                           : preadv(file_descriptor, remaining.data(), remaining.size(), offset);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result == -1) {
+            return -errno;
+        }
+        if (result == 0) {
+            if (request->is_write) {
+                return -EIO;
+            }
+            for (const struct iovec& vector : remaining) {
+                memset(vector.iov_base, 0, vector.iov_len);
+            }
+            return request->length;
+        }
+        done += result;
+    }
+    return done;
+}
@@ -0,0 +1,45 @@
+#ifndef IO_H
+#define IO_H
+
+#include "common.h"
+#include <atomic>
+#include <sys/uio.h>
+
+// --- Asynchronous Page I/O ---
+// A submission queue for batches of positioned reads and writes against one
+// file. It uses io_uring when the kernel allows it and otherwise falls back
+// to a small pool of threads issuing preadv/pwritev, so callers can keep
+// many requests in flight either way.
+enum IoBackend { IO_BACKEND_AUTO, IO_BACKEND_URING, IO_BACKEND_THREADS };
+
+// Requests handed to the kernel at once; later ones queue behind them.
+const uint32_t IO_QUEUE_DEPTH = 64;
+const uint32_t IO_THREAD_POOL_SIZE = 4;
+
+// One vectored transfer; adjacent pages are coalesced into a single request
+// with one iovec per page. The caller owns the request until it completes.
+struct IoRequest {
+    bool is_write;
+    uint64_t offset;
+    std::vector<struct iovec> iov;
+    uint64_t length;   // sum of the iovec lengths
+    int64_t result;    // bytes transferred, or -errno
+    std::atomic<bool> completed;
+    uint64_t user_data; // for the caller; the queue never touches it
+};
+
+struct IoQueue;
+
+IoQueue* io_queue_open(int file_descriptor, IoBackend backend);
+void io_queue_close(IoQueue* queue);
+IoBackend io_queue_backend(IoQueue* queue);
+bool parse_io_backend(const std::string& name, IoBackend* backend);
+const char* io_backend_name(IoBackend backend);
+
+void io_submit(IoQueue* queue, IoRequest* const* requests, uint32_t num_requests);
+void io_wait(IoQueue* queue, IoRequest* request);
+void io_wait_all(IoQueue* queue);
+void io_poll(IoQueue* queue);
+uint32_t io_in_flight(IoQueue* queue);
+
+#endif // IO_H
@@ -2,70 +2,554 @@
 #include "row.h"
 #include "table.h"
 #include "btree.h"
+#include "sink.h"
+#include "metrics.h"
+#include "explain.h"
+#include <algorithm>
+#include <memory>
+#include <sstream>
 
-enum StatementType { STATEMENT_INSERT, STATEMENT_SELECT, STATEMENT_DELETE };
+enum StatementType { STATEMENT_INSERT, STATEMENT_SELECT, STATEMENT_DELETE, STATEMENT_UPDATE, STATEMENT_UPSERT,
+                     STATEMENT_TRUNCATE, STATEMENT_CREATE_TABLE, STATEMENT_DROP_TABLE };
 
 struct Statement {
     StatementType type;
     Row row_to_insert;
     uint32_t id_to_delete;
+    // "delete where id between <a> and <b>": deletes range_start..range_end.
+    bool has_delete_range;
+    // "insert values (...), (...)": inserted together as one batch.
+    std::vector<Row> rows_to_insert;
+    // UPDATE: the UpdateColumn bits of row_to_insert to assign.
+    uint32_t update_columns;
+    // CREATE TABLE / DROP TABLE.
+    std::string table_name;
+    LeafLayout leaf_layout;
+
+    // SELECT clauses: an optional aggregate, an inclusive id range and
+    // LIMIT/OFFSET applied in id order, descending for "order by id desc".
+    bool has_aggregate;
+    AggregateType aggregate_type;
+    AggregateColumn aggregate_column;
+    uint32_t range_start;
+    uint32_t range_end;
+    uint32_t limit;
+    uint32_t offset;
+    bool descending;
+    // "where id in (...)": the ids to look up, sorted and without repeats.
+    bool has_id_list;
+    std::vector<uint32_t> id_list;
+
+    // Run under "explain analyze": rows are discarded and a trace of the
+    // execution is printed instead.
+    bool explain;
 };
 
 void print_prompt() {
     std::cout << "db > ";
 }
 
-void print_row(const Row& row) {
-    std::cout << "(" << row.id << ", " << row.username << ", " << row.email << ")" << std::endl;
-}
-
-void print_constants() {
+void print_constants(Database* database) {
+    const NodeLayout& layout = database->layout;
+    std::cout << "PAGE_SIZE: " << layout.page_size << std::endl;
     std::cout << "ROW_SIZE: " << ROW_SIZE << std::endl;
     std::cout << "COMMON_NODE_HEADER_SIZE: " << COMMON_NODE_HEADER_SIZE << std::endl;
     std::cout << "LEAF_NODE_HEADER_SIZE: " << LEAF_NODE_HEADER_SIZE << std::endl;
     std::cout << "LEAF_NODE_CELL_SIZE: " << LEAF_NODE_CELL_SIZE << std::endl;
-    std::cout << "LEAF_NODE_SPACE_FOR_CELLS: " << LEAF_NODE_SPACE_FOR_CELLS << std::endl;
-    std::cout << "LEAF_NODE_MAX_CELLS: " << LEAF_NODE_MAX_CELLS << std::endl;
+    std::cout << "LEAF_NODE_SPACE_FOR_CELLS: " << layout.page_size - LEAF_NODE_KEY_DELTAS_OFFSET << std::endl;
+    std::cout << "LEAF_NODE_MAX_CELLS: " << layout.leaf_max_cells << std::endl;
     std::cout << "INTERNAL_NODE_HEADER_SIZE: " << INTERNAL_NODE_HEADER_SIZE << std::endl;
     std::cout << "INTERNAL_NODE_CELL_SIZE: " << INTERNAL_NODE_CELL_SIZE << std::endl;
-    std::cout << "INTERNAL_NODE_MAX_CELLS: " << INTERNAL_NODE_MAX_CELLS << std::endl;
+    std::cout << "INTERNAL_NODE_MAX_CELLS: " << layout.internal_max_cells << std::endl;
+    std::cout << "INTERNAL_NODE_MAX_CELLS_16_BIT_KEYS: " << internal_node_max_cells(layout.page_size, sizeof(uint16_t)) << std::endl;
+    std::cout << "INTERNAL_NODE_MAX_CELLS_8_BIT_KEYS: " << internal_node_max_cells(layout.page_size, sizeof(uint8_t)) << std::endl;
+}
+
+// .export <file> [text|csv|tsv|binary] streams every row from the leaf
+// chain into a buffered sink; csv is the default.
+void export_table(const std::string& command, Table* table) {
+    std::istringstream tokens(command);
+    std::string keyword, filename, format_name = "csv", extra;
+    tokens >> keyword >> filename >> format_name >> extra;
+    SinkFormat format;
+    if (filename.empty() || !extra.empty() || !parse_sink_format(format_name, &format)) {
+        std::cout << "Usage: .export <file> [text|csv|tsv|binary]" << std::endl;
+        return;
+    }
+
+    ResultSink* sink = sink_open_file(filename, format);
+    if (sink == nullptr) {
+        return;
+    }
+    Cursor* cursor = table_start(table);
+    while (!(cursor->end_of_table)) {
+        sink_write_row(sink, cursor_row(cursor));
+        cursor_advance(cursor);
+    }
+    delete cursor;
+    uint64_t rows_written = sink->rows_written;
+    sink_close(sink);
+    std::cout << "Exported " << rows_written << " rows to '" << filename << "'." << std::endl;
+}
+
+// .stats prints the metrics registry; .stats prometheus <path> writes it in
+// Prometheus text format to a file or an existing Unix domain socket.
+void print_stats(const std::string& command, Table* table) {
+    std::istringstream tokens(command);
+    std::string keyword, format, path;
+    tokens >> keyword >> format >> path;
+    // The height gauge describes the table in use; splits and collapses in
+    // other trees, the catalog included, do not move it.
+    metrics_gauge_set(METRIC_GAUGE_TREE_HEIGHT, table != nullptr ? table_height(table) : 0);
+    if (format.empty()) {
+        metrics_print(std::cout);
+    } else if (format == "prometheus" && !path.empty()) {
+        if (metrics_write_prometheus(path)) {
+            std::cout << "Wrote metrics to '" << path << "'." << std::endl;
+        }
+    } else {
+        std::cout << "Usage: .stats [prometheus <path>]" << std::endl;
+    }
+}
+
+bool parse_uint32(const std::string& token, uint32_t* value);
+
+// .reorganize [<fill percent>] rebuilds the file so each table's leaves sit
+// in key order in consecutive pages and a scan reads it front to back.
+void reorganize_database(const std::string& command, Database* database) {
+    std::istringstream tokens(command);
+    std::string keyword, fill, extra;
+    tokens >> keyword >> fill >> extra;
+    uint32_t fill_percent = REORGANIZE_DEFAULT_FILL_PERCENT;
+    if (!extra.empty() || (!fill.empty() && (!parse_uint32(fill, &fill_percent) ||
+                                             fill_percent < REORGANIZE_MIN_FILL_PERCENT || fill_percent > 100))) {
+        std::cout << "Usage: .reorganize [<fill percent, " << REORGANIZE_MIN_FILL_PERCENT << " to 100>]" << std::endl;
+        return;
+    }
+    uint32_t num_pages = db_reorganize(database, fill_percent);
+    std::cout << "Reorganized into " << num_pages << " pages." << std::endl;
+}
+
+// .use <table> picks the table statements run against.
+void use_table(const std::string& command, Database* database, Table** table) {
+    std::istringstream tokens(command);
+    std::string keyword, name, extra;
+    tokens >> keyword >> name >> extra;
+    if (name.empty() || !extra.empty()) {
+        std::cout << "Usage: .use <table>" << std::endl;
+        return;
+    }
+    Table* found = db_table(database, name);
+    if (found == nullptr) {
+        std::cout << "Error: Table '" << name << "' does not exist." << std::endl;
+        return;
+    }
+    *table = found;
+    metrics_gauge_set(METRIC_GAUGE_TREE_HEIGHT, table_height(found));
+    std::cout << "Using table '" << name << "'." << std::endl;
+}
+
+// Meta commands that read or rebuild a tree need a table in use.
+bool require_table(Table* table) {
+    if (table == nullptr) {
+        std::cout << "Error: No table in use. Create one with 'create table <name>'." << std::endl;
+        return false;
+    }
+    return true;
 }
 
-void do_meta_command(const std::string& command, Table* table) {
+void do_meta_command(const std::string& command, Database* database, Table** table) {
     if (command == ".exit") {
-        db_close(table);
+        db_close(database);
         std::cout << "Bye!" << std::endl;
         exit(EXIT_SUCCESS);
     } else if (command == ".btree") {
-        std::cout << "Tree:" << std::endl;
-        print_tree(table->pager, table->root_page_num, 0);
+        if (require_table(*table)) {
+            std::cout << "Tree:" << std::endl;
+            print_tree((*table)->pager, (*table)->layout, (*table)->root_page_num, 0);
+        }
+    } else if (command == ".checkpoint") {
+        db_checkpoint(database);
+        std::cout << "Checkpoint complete." << std::endl;
     } else if (command == ".constants") {
         std::cout << "Constants:" << std::endl;
-        print_constants();
+        print_constants(database);
+    } else if (command == ".stats" || command.rfind(".stats ", 0) == 0) {
+        print_stats(command, *table);
+    } else if (command == ".export" || command.rfind(".export ", 0) == 0) {
+        if (require_table(*table)) {
+            export_table(command, *table);
+        }
+    } else if (command == ".reorganize" || command.rfind(".reorganize ", 0) == 0) {
+        reorganize_database(command, database);
+    } else if (command == ".tables") {
+        for (Table* listed : database->tables) {
+            std::cout << listed->name << " (" << leaf_layout_name(listed->layout.leaf_layout) << ")" << std::endl;
+        }
+    } else if (command == ".use" || command.rfind(".use ", 0) == 0) {
+        use_table(command, database, table);
     } else {
         std::cout << "Unrecognized command '" << command << "'" << std::endl;
     }
 }
 
+bool parse_uint32(const std::string& token, uint32_t* value) {
+    if (token.empty() || token[0] == '-') {
+        return false;
+    }
+    char* end;
+    errno = 0;
+    unsigned long parsed = strtoul(token.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE || parsed > UINT32_MAX) {
+        return false;
+    }
+    *value = (uint32_t)parsed;
+    return true;
+}
+
+// Parses "count(*)", "min(id)", "sum(length(email))" and friends.
+bool parse_aggregate(const std::string& token, Statement* statement) {
+    size_t open_paren = token.find('(');
+    if (open_paren == std::string::npos || token.back() != ')') {
+        return false;
+    }
+    std::string function = token.substr(0, open_paren);
+    std::string argument = token.substr(open_paren + 1, token.size() - open_paren - 2);
+
+    if (function == "count") {
+        statement->aggregate_type = AGGREGATE_COUNT;
+    } else if (function == "min") {
+        statement->aggregate_type = AGGREGATE_MIN;
+    } else if (function == "max") {
+        statement->aggregate_type = AGGREGATE_MAX;
+    } else if (function == "sum") {
+        statement->aggregate_type = AGGREGATE_SUM;
+    } else {
+        return false;
+    }
+
+    if (argument == "id" || (argument == "*" && function == "count")) {
+        statement->aggregate_column = COLUMN_ID;
+    } else if (argument == "length(username)") {
+        statement->aggregate_column = COLUMN_USERNAME_LENGTH;
+    } else if (argument == "length(email)") {
+        statement->aggregate_column = COLUMN_EMAIL_LENGTH;
+    } else {
+        return false;
+    }
+    statement->has_aggregate = true;
+    return true;
+}
+
+// Parses the rest of "where id in (<a>, <b>, ...)" from `tokens`.
+bool parse_id_list(std::istringstream& tokens, Statement* statement) {
+    std::string list;
+    std::string word;
+    while (list.find(')') == std::string::npos && tokens >> word) {
+        list += word;
+    }
+    if (list.size() < 2 || list.front() != '(' || list.back() != ')') {
+        return false;
+    }
+    std::istringstream ids(list.substr(1, list.size() - 2));
+    std::string id_token;
+    statement->id_list.clear();
+    while (std::getline(ids, id_token, ',')) {
+        uint32_t id;
+        if (!parse_uint32(id_token, &id)) {
+            return false;
+        }
+        statement->id_list.push_back(id);
+    }
+    std::sort(statement->id_list.begin(), statement->id_list.end());
+    statement->id_list.erase(std::unique(statement->id_list.begin(), statement->id_list.end()), statement->id_list.end());
+    statement->has_id_list = true;
+    return !statement->id_list.empty();
+}
+
+// select [<aggregate>] [where id between <a> and <b> | where id in (<a>, ...)] [order by id [asc|desc]]
+//        [limit <n>] [offset <m>]
+bool prepare_select(const std::string& input, Statement* statement) {
+    statement->type = STATEMENT_SELECT;
+    statement->has_aggregate = false;
+    statement->has_id_list = false;
+    statement->range_start = 0;
+    statement->range_end = UINT32_MAX;
+    statement->limit = UINT32_MAX;
+    statement->offset = 0;
+    statement->descending = false;
+    bool has_order = false;
+
+    std::istringstream tokens(input);
+    std::string word;
+    tokens >> word;
+    while (tokens >> word) {
+        if (word == "where") {
+            std::string column, between, start, conjunction, end;
+            tokens >> column >> between;
+            if (column == "id" && between == "in") {
+                if (!parse_id_list(tokens, statement)) {
+                    std::cout << "Syntax error. Expected 'where id in (<a>, <b>, ...)'." << std::endl;
+                    return false;
+                }
+                continue;
+            }
+            tokens >> start >> conjunction >> end;
+            if (column != "id" || between != "between" || conjunction != "and" ||
+                !parse_uint32(start, &statement->range_start) || !parse_uint32(end, &statement->range_end)) {
+                std::cout << "Syntax error. Expected 'where id between <a> and <b>'." << std::endl;
+                return false;
+            }
+        } else if (word == "order") {
+            std::string by, column;
+            tokens >> by >> column;
+            if (by != "by" || column != "id") {
+                std::cout << "Syntax error. Expected 'order by id [asc|desc]'." << std::endl;
+                return false;
+            }
+            // The direction is optional; put back a word that is not one.
+            std::streampos position = tokens.tellg();
+            std::string direction;
+            if (tokens >> direction && (direction == "asc" || direction == "desc")) {
+                statement->descending = direction == "desc";
+            } else {
+                tokens.clear();
+                tokens.seekg(position);
+            }
+            has_order = true;
+        } else if (word == "limit" || word == "offset") {
+            std::string number;
+            tokens >> number;
+            if (!parse_uint32(number, word == "limit" ? &statement->limit : &statement->offset)) {
+                std::cout << "Syntax error. Expected a number after '" << word << "'." << std::endl;
+                return false;
+            }
+        } else if (statement->has_aggregate || !parse_aggregate(word, statement)) {
+            std::cout << "Syntax error. Unexpected '" << word << "' in select." << std::endl;
+            return false;
+        }
+    }
+    if (statement->has_aggregate && statement->has_id_list) {
+        std::cout << "Aggregates do not support 'where id in'." << std::endl;
+        return false;
+    }
+    if (statement->has_aggregate && has_order) {
+        std::cout << "Aggregates do not support 'order by'." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Fills `row` from the fields of one VALUES tuple, "<id>, <username>, <email>".
+bool parse_row_tuple(const std::string& tuple, Row* row) {
+    std::vector<std::string> fields;
+    std::istringstream stream(tuple);
+    std::string field;
+    while (std::getline(stream, field, ',')) {
+        size_t first = field.find_first_not_of(" \t");
+        size_t last = field.find_last_not_of(" \t");
+        fields.push_back(first == std::string::npos ? "" : field.substr(first, last - first + 1));
+    }
+    if (fields.size() != 3 || !parse_uint32(fields[0], &row->id) || fields[1].empty() || fields[2].empty() ||
+        fields[1].size() > COLUMN_USERNAME_SIZE || fields[2].size() > COLUMN_EMAIL_SIZE) {
+        return false;
+    }
+    strcpy(row->username, fields[1].c_str());
+    strcpy(row->email, fields[2].c_str());
+    return true;
+}
+
+// insert|upsert <id> <username> <email>. The values are checked against
+// the column sizes before anything is copied into the row.
+bool prepare_row_statement(const std::string& input, Statement* statement) {
+    std::istringstream tokens(input);
+    std::string keyword, id, username, email;
+    tokens >> keyword >> id >> username >> email;
+    statement->row_to_insert = {};
+    if (email.empty()) {
+        std::cout << "Syntax error. Could not parse statement." << std::endl;
+        return false;
+    }
+    if (id[0] == '-') {
+        std::cout << "ID must be positive." << std::endl;
+        return false;
+    }
+    if (!parse_uint32(id, &statement->row_to_insert.id)) {
+        std::cout << "Syntax error. Could not parse statement." << std::endl;
+        return false;
+    }
+    if (username.size() > COLUMN_USERNAME_SIZE || email.size() > COLUMN_EMAIL_SIZE) {
+        std::cout << "String is too long." << std::endl;
+        return false;
+    }
+    strcpy(statement->row_to_insert.username, username.c_str());
+    strcpy(statement->row_to_insert.email, email.c_str());
+    return true;
+}
+
+// insert values (<id>, <username>, <email>)[, (...)]...
+bool prepare_insert_values(const std::string& input, Statement* statement) {
+    statement->type = STATEMENT_INSERT;
+    statement->rows_to_insert.clear();
+    size_t position = input.find("values") + strlen("values");
+    while (true) {
+        size_t open_paren = input.find_first_not_of(" \t", position);
+        size_t close_paren = open_paren == std::string::npos ? std::string::npos : input.find(')', open_paren);
+        Row row = {};
+        if (close_paren == std::string::npos || input[open_paren] != '(' ||
+            !parse_row_tuple(input.substr(open_paren + 1, close_paren - open_paren - 1), &row)) {
+            std::cout << "Syntax error. Expected '(<id>, <username>, <email>)' tuples after 'values'." << std::endl;
+            return false;
+        }
+        statement->rows_to_insert.push_back(row);
+        position = input.find_first_not_of(" \t", close_paren + 1);
+        if (position == std::string::npos) {
+            return true;
+        }
+        if (input[position] != ',') {
+            std::cout << "Syntax error. Expected ',' between value tuples." << std::endl;
+            return false;
+        }
+        position++;
+    }
+}
+
+// update <id> set username = <username>[, email = <email>]
+bool prepare_update(const std::string& input, Statement* statement) {
+    statement->type = STATEMENT_UPDATE;
+    statement->update_columns = 0;
+    statement->row_to_insert = {};
+    std::istringstream tokens(input);
+    std::string keyword, id, set;
+    tokens >> keyword >> id >> set;
+    if (!parse_uint32(id, &statement->row_to_insert.id) || set != "set") {
+        std::cout << "Syntax error. Expected 'update <id> set <column> = <value>[, ...]'." << std::endl;
+        return false;
+    }
+
+    std::string assignments;
+    std::getline(tokens, assignments);
+    std::istringstream list(assignments);
+    std::string assignment;
+    while (std::getline(list, assignment, ',')) {
+        size_t equals = assignment.find('=');
+        std::string column = equals == std::string::npos ? "" : assignment.substr(0, equals);
+        std::string value = equals == std::string::npos ? "" : assignment.substr(equals + 1);
+        column.erase(0, column.find_first_not_of(" \t"));
+        column.erase(column.find_last_not_of(" \t") + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+        value.erase(value.find_last_not_of(" \t") + 1);
+        if (value.empty() || value.find_first_of(" \t") != std::string::npos) {
+            std::cout << "Syntax error. Expected '<column> = <value>' after 'set'." << std::endl;
+            return false;
+        }
+        if ((column == "username" && value.size() > COLUMN_USERNAME_SIZE) ||
+            (column == "email" && value.size() > COLUMN_EMAIL_SIZE)) {
+            std::cout << "String is too long." << std::endl;
+            return false;
+        }
+        if (column == "username") {
+            strcpy(statement->row_to_insert.username, value.c_str());
+            statement->update_columns |= UPDATE_USERNAME;
+        } else if (column == "email") {
+            strcpy(statement->row_to_insert.email, value.c_str());
+            statement->update_columns |= UPDATE_EMAIL;
+        } else {
+            std::cout << "Error: Unknown column '" << column << "'." << std::endl;
+            return false;
+        }
+    }
+    if (statement->update_columns == 0) {
+        std::cout << "Syntax error. Expected '<column> = <value>' after 'set'." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// create table <name> [using row|pax] | drop table <name>. Names are
+// letters, digits and underscores, not starting with a digit.
+bool prepare_table_statement(const std::string& input, Statement* statement) {
+    std::istringstream tokens(input);
+    std::string keyword, table_keyword, name, using_keyword, layout_name, extra;
+    tokens >> keyword >> table_keyword >> name >> using_keyword >> layout_name >> extra;
+    statement->type = keyword == "create" ? STATEMENT_CREATE_TABLE : STATEMENT_DROP_TABLE;
+    statement->table_name = name;
+    statement->leaf_layout = LEAF_LAYOUT_ROW;
+    if (statement->type == STATEMENT_CREATE_TABLE && input.find('(') != std::string::npos) {
+        std::cout << "Error: Column lists are not supported. Every table has the id, username and email columns."
+                  << std::endl;
+        return false;
+    }
+    if (table_keyword != "table" || name.empty() || !extra.empty() ||
+        (statement->type == STATEMENT_DROP_TABLE && !using_keyword.empty())) {
+        std::cout << "Syntax error. Expected '" << keyword << " table <name>'." << std::endl;
+        return false;
+    }
+    if (!using_keyword.empty() && (using_keyword != "using" || !parse_leaf_layout(layout_name, &statement->leaf_layout))) {
+        std::cout << "Syntax error. Expected 'create table <name> [using row|pax]'." << std::endl;
+        return false;
+    }
+    bool valid = name.size() <= MAX_TABLE_NAME_LENGTH && !isdigit((unsigned char)name[0]);
+    for (char c : name) {
+        valid = valid && (isalnum((unsigned char)c) || c == '_');
+    }
+    if (!valid) {
+        std::cout << "Error: Table names are up to " << MAX_TABLE_NAME_LENGTH
+                  << " letters, digits or underscores, not starting with a digit." << std::endl;
+        return false;
+    }
+    return true;
+}
+
 bool prepare_statement(const std::string& input, Statement* statement) {
+    statement->explain = false;
+    if (input.rfind("explain analyze ", 0) == 0) {
+        if (!prepare_statement(input.substr(strlen("explain analyze ")), statement)) {
+            return false;
+        }
+        statement->explain = true;
+        return true;
+    }
+    if (input.rfind("insert values", 0) == 0) {
+        return prepare_insert_values(input, statement);
+    }
     if (input.rfind("insert", 0) == 0) {
         statement->type = STATEMENT_INSERT;
-        int args_assigned = sscanf(input.c_str(), "insert %u %s %s",
-                                  &statement->row_to_insert.id,
-                                  statement->row_to_insert.username,
-                                  statement->row_to_insert.email);
-        if (args_assigned < 3) {
-            std::cout << "Syntax error. Could not parse statement." << std::endl;
+        return prepare_row_statement(input, statement);
+    }
+    if (input.rfind("upsert", 0) == 0) {
+        statement->type = STATEMENT_UPSERT;
+        return prepare_row_statement(input, statement);
+    }
+    if (input.rfind("update", 0) == 0) {
+        return prepare_update(input, statement);
+    }
+    if (input.rfind("select", 0) == 0) {
+        return prepare_select(input, statement);
+    }
+    if (input.rfind("delete where", 0) == 0) {
+        statement->type = STATEMENT_DELETE;
+        statement->has_delete_range = true;
+        std::istringstream tokens(input);
+        std::string keyword, where, column, between, start, conjunction, end, extra;
+        tokens >> keyword >> where >> column >> between >> start >> conjunction >> end;
+        if (column != "id" || between != "between" || conjunction != "and" || (tokens >> extra) ||
+            !parse_uint32(start, &statement->range_start) || !parse_uint32(end, &statement->range_end)) {
+            std::cout << "Syntax error. Expected 'delete where id between <a> and <b>'." << std::endl;
             return false;
         }
         return true;
     }
-    if (input == "select") {
-        statement->type = STATEMENT_SELECT;
+    if (input == "truncate") {
+        statement->type = STATEMENT_TRUNCATE;
         return true;
     }
+    if (input.rfind("create table", 0) == 0 || input.rfind("drop table", 0) == 0) {
+        return prepare_table_statement(input, statement);
+    }
     if (input.rfind("delete", 0) == 0) {
         statement->type = STATEMENT_DELETE;
+        statement->has_delete_range = false;
         int args_assigned = sscanf(input.c_str(), "delete %u", &statement->id_to_delete);
         if (args_assigned < 1) {
             std::cout << "Syntax error. Must provide an ID to delete." << std::endl;
@@ -78,30 +562,213 @@ bool prepare_statement(const std::string& input, Statement* statement) {
     return false;
 }
 
-void execute_statement(Statement* statement, Table* table) {
+void print_execute_result(ExecuteResult result, uint32_t key) {
+    switch (result) {
+        case EXECUTE_SUCCESS:
+            std::cout << "Executed." << std::endl;
+            break;
+        case EXECUTE_DUPLICATE_KEY:
+            std::cout << "Error: Duplicate key." << std::endl;
+            break;
+        case EXECUTE_KEY_NOT_FOUND:
+            std::cout << "Error: Key " << key << " not found." << std::endl;
+            break;
+    }
+}
+
+// Fetches the listed ids with one multi-get and prints the rows found in
+// id order (or reversed), LIMIT and OFFSET counting only those.
+void select_id_list(Statement* statement, Table* table, ExplainTrace* trace) {
+    const std::vector<uint32_t>& ids = statement->id_list;
+    std::vector<Row> rows(ids.size());
+    std::unique_ptr<bool[]> found(new bool[ids.size()]);
+    table_multiget(table, ids.data(), ids.size(), rows.data(), found.get());
+    explain_phase(trace, PHASE_SCAN);
+
+    std::cout.flush();
+    ResultSink* sink = sink_open(STDOUT_FILENO, SINK_TEXT);
+    uint32_t skipped = 0;
+    uint32_t rows_returned = 0;
+    std::vector<char> value(ROW_SIZE);
+    for (uint32_t n = 0; n < ids.size() && rows_returned < statement->limit; n++) {
+        uint32_t i = statement->descending ? ids.size() - 1 - n : n;
+        if (!found[i]) {
+            continue;
+        }
+        if (skipped < statement->offset) {
+            skipped++;
+            continue;
+        }
+        if (trace == nullptr) {
+            serialize_row(&rows[i], value.data());
+            sink_write_row(sink, row_view(value.data()));
+        }
+        rows_returned++;
+    }
+    sink_close(sink);
+    metrics_increment(METRIC_ROWS_RETURNED, rows_returned);
+    if (trace != nullptr) {
+        std::cout << "(" << rows_returned << " rows)" << std::endl;
+    }
+    std::cout << "Executed." << std::endl;
+}
+
+void execute_statement(Statement* statement, Database* database, Table* table) {
+    uint64_t start_ns = metrics_now_ns();
+    ExplainTrace* trace = statement->explain ? explain_begin(database->pager) : nullptr;
     switch (statement->type) {
         case STATEMENT_INSERT:
-            table_insert(table, &(statement->row_to_insert));
+            if (statement->rows_to_insert.empty()) {
+                print_execute_result(table_insert(table, &(statement->row_to_insert)), statement->row_to_insert.id);
+            } else {
+                std::vector<Row>& rows = statement->rows_to_insert;
+                std::vector<ExecuteResult> results(rows.size());
+                table_insert_batch(table, rows.data(), rows.size(), results.data());
+                for (uint32_t i = 0; i < rows.size(); i++) {
+                    if (results[i] != EXECUTE_SUCCESS) {
+                        std::cout << "Error: Duplicate key " << rows[i].id << "." << std::endl;
+                    }
+                }
+                std::cout << "Executed." << std::endl;
+            }
             break;
         case STATEMENT_SELECT:
-            {
-                Cursor* cursor = table_start(table);
-                Row row;
-                while (!(cursor->end_of_table)) {
-                    deserialize_row(cursor_value(cursor), &row);
-                    print_row(row);
-                    cursor_advance(cursor);
+            if (statement->has_aggregate) {
+                AggregateResult result = table_aggregate(table, statement->aggregate_type, statement->aggregate_column,
+                                                         statement->range_start, statement->range_end);
+                if (result.is_null) {
+                    std::cout << "(NULL)" << std::endl;
+                } else {
+                    std::cout << "(" << result.value << ")" << std::endl;
+                }
+                std::cout << "Executed." << std::endl;
+            } else if (statement->has_id_list) {
+                select_id_list(statement, table, trace);
+            } else {
+                // OFFSET is resolved through the subtree counts, so deep
+                // pages cost a descent rather than a walk over skipped rows.
+                // A descending scan starts from the end of the range and
+                // walks the leaf chain backwards.
+                Cursor* cursor;
+                if (!statement->descending) {
+                    uint64_t first = (uint64_t)table_rank(table, statement->range_start) + statement->offset;
+                    cursor = table_find_nth(table, first > UINT32_MAX ? UINT32_MAX : (uint32_t)first);
+                } else if (statement->offset == 0) {
+                    cursor = table_find_last(table, statement->range_end);
+                } else {
+                    uint32_t end = statement->range_end == UINT32_MAX ? table_row_count(table)
+                                                                      : table_rank(table, statement->range_end + 1);
+                    cursor = table_find_nth(table, end > statement->offset ? end - 1 - statement->offset : UINT32_MAX);
+                }
+                explain_phase(trace, PHASE_SCAN);
+                // Rows bypass iostream and go out in large writes; flush
+                // what std::cout holds first so output stays in order.
+                std::cout.flush();
+                ResultSink* sink = sink_open(STDOUT_FILENO, SINK_TEXT);
+                uint32_t rows_returned = 0;
+                while (!(cursor->end_of_table) && rows_returned < statement->limit) {
+                    RowView row = cursor_row(cursor);
+                    if (statement->descending ? row.id() < statement->range_start : row.id() > statement->range_end) {
+                        break;
+                    }
+                    if (trace == nullptr) {
+                        sink_write_row(sink, row);
+                    }
+                    rows_returned++;
+                    if (statement->descending) {
+                        cursor_retreat(cursor);
+                    } else {
+                        cursor_advance(cursor);
+                    }
                 }
                 delete cursor;
+                sink_close(sink);
+                metrics_increment(METRIC_ROWS_RETURNED, rows_returned);
+                if (trace != nullptr) {
+                    std::cout << "(" << rows_returned << " rows)" << std::endl;
+                }
+                std::cout << "Executed." << std::endl;
+            }
+            break;
+        case STATEMENT_DELETE:
+            if (statement->has_delete_range) {
+                uint32_t rows_deleted = table_delete_range(table, statement->range_start, statement->range_end);
+                std::cout << "Deleted " << rows_deleted << " rows." << std::endl;
+                std::cout << "Executed." << std::endl;
+            } else {
+                print_execute_result(table_delete(table, statement->id_to_delete), statement->id_to_delete);
+            }
+            break;
+        case STATEMENT_TRUNCATE:
+            table_truncate(table);
+            std::cout << "Executed." << std::endl;
+            break;
+        case STATEMENT_UPDATE:
+            print_execute_result(table_update(table, &(statement->row_to_insert), statement->update_columns),
+                                 statement->row_to_insert.id);
+            break;
+        case STATEMENT_UPSERT:
+            print_execute_result(table_upsert(table, &(statement->row_to_insert)), statement->row_to_insert.id);
+            break;
+        case STATEMENT_CREATE_TABLE:
+            if (db_create_table(database, statement->table_name, statement->leaf_layout) == nullptr) {
+                std::cout << "Error: Table '" << statement->table_name << "' already exists." << std::endl;
+            } else {
+                std::cout << "Executed." << std::endl;
+            }
+            break;
+        case STATEMENT_DROP_TABLE:
+            if (table != nullptr && table->name == statement->table_name) {
+                std::cout << "Error: Table '" << statement->table_name << "' is in use." << std::endl;
+            } else if (!db_drop_table(database, statement->table_name)) {
+                std::cout << "Error: Table '" << statement->table_name << "' does not exist." << std::endl;
+            } else {
                 std::cout << "Executed." << std::endl;
             }
             break;
+    }
+
+    uint64_t elapsed_ns = metrics_now_ns() - start_ns;
+    switch (statement->type) {
+        case STATEMENT_INSERT:
+            metrics_increment(METRIC_STATEMENTS_INSERT);
+            metrics_observe(HISTOGRAM_STATEMENT_INSERT, elapsed_ns);
+            break;
+        case STATEMENT_SELECT:
+            metrics_increment(METRIC_STATEMENTS_SELECT);
+            metrics_observe(HISTOGRAM_STATEMENT_SELECT, elapsed_ns);
+            break;
         case STATEMENT_DELETE:
-            table_delete(table, statement->id_to_delete);
+        case STATEMENT_TRUNCATE:
+            metrics_increment(METRIC_STATEMENTS_DELETE);
+            metrics_observe(HISTOGRAM_STATEMENT_DELETE, elapsed_ns);
+            break;
+        case STATEMENT_UPDATE:
+            metrics_increment(METRIC_STATEMENTS_UPDATE);
+            metrics_observe(HISTOGRAM_STATEMENT_UPDATE, elapsed_ns);
+            break;
+        case STATEMENT_UPSERT:
+            metrics_increment(METRIC_STATEMENTS_UPSERT);
+            metrics_observe(HISTOGRAM_STATEMENT_UPSERT, elapsed_ns);
             break;
+        case STATEMENT_CREATE_TABLE:
+        case STATEMENT_DROP_TABLE:
+            break;
+    }
+
+    if (trace != nullptr) {
+        explain_end(database->pager);
+        explain_print(trace, std::cout);
+        delete trace;
     }
 }
 
+void print_usage() {
+    std::cout << "Usage: db <filename> [--page-size <bytes>] [--pager buffered|mmap] [--io auto|uring|threads]"
+              << " [--direct] [--huge-pages] [--readahead <leaves>] [--compress]" << std::endl;
+    exit(EXIT_FAILURE);
+}
+
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         std::cout << "Must supply a database filename." << std::endl;
@@ -109,7 +776,55 @@ int main(int argc, char* argv[]) {
     }
 
     std::string filename = argv[1];
-    Table* table = db_open(filename);
+    PagerOptions options;
+    for (int i = 2; i < argc; i++) {
+        std::string flag = argv[i];
+        if (flag == "--direct") {
+            options.direct_io = true;
+            continue;
+        }
+        if (flag == "--huge-pages") {
+            options.huge_pages = true;
+            continue;
+        }
+        if (flag == "--compress") {
+            options.compress = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            print_usage();
+        }
+        std::string value = argv[++i];
+        if (flag == "--page-size") {
+            if (!parse_uint32(value, &options.page_size) || !pager_valid_page_size(options.page_size)) {
+                std::cout << "Page size must be a power of two from " << MIN_PAGE_SIZE << " to " << MAX_PAGE_SIZE << "." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        } else if (flag == "--pager") {
+            if (!parse_pager_backend(value, &options.backend)) {
+                std::cout << "Unknown pager backend '" << value << "'." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        } else if (flag == "--readahead") {
+            if (!parse_uint32(value, &options.readahead_window)) {
+                print_usage();
+            }
+        } else if (flag == "--io") {
+            if (!parse_io_backend(value, &options.io_backend)) {
+                std::cout << "Unknown I/O backend '" << value << "'." << std::endl;
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            print_usage();
+        }
+    }
+    Database* database = db_open(filename, options);
+    // Statements run against the users table, or the first table in the
+    // catalog if it has been dropped, until .use picks another.
+    Table* table = db_table(database, DEFAULT_TABLE_NAME);
+    if (table == nullptr && !database->tables.empty()) {
+        table = database->tables[0];
+    }
 
     std::string input_line;
     while (true) {
@@ -121,13 +836,15 @@ int main(int argc, char* argv[]) {
         }
 
         if (input_line[0] == '.') {
-            do_meta_command(input_line, table);
+            do_meta_command(input_line, database, &table);
             continue;
         }
 
         Statement statement;
-        if (prepare_statement(input_line, &statement)) {
-            execute_statement(&statement, table);
+        if (prepare_statement(input_line, &statement) &&
+            (statement.type == STATEMENT_CREATE_TABLE || statement.type == STATEMENT_DROP_TABLE ||
+             require_table(table))) {
+            execute_statement(&statement, database, table);
         }
     }
 
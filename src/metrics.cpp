@@ -0,0 +1,174 @@
+#include "metrics.h"
+#include <sstream>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+Metrics metrics;
+
+struct MetricInfo {
+    const char* name;
+    const char* help;
+};
+
+// Indexed by the enums in metrics.h; keep the orders in sync.
+static const MetricInfo COUNTER_INFO[NUM_METRIC_COUNTERS] = {
+    {"buffer_hits_total", "Page requests served from the buffer pool."},
+    {"buffer_misses_total", "Page requests that had to go to the file."},
+    {"pages_read_total", "Pages read from the database file."},
+    {"pages_written_total", "Pages written to the database file."},
+    {"read_bytes_total", "Bytes read from the database file."},
+    {"written_bytes_total", "Bytes written to the database file."},
+    {"pages_allocated_total", "New pages appended to the database."},
+    {"pages_freed_total", "Pages put on the free list for reuse."},
+    {"pages_evicted_total", "Pages dropped from the buffer pool to make room."},
+    {"pages_prefetched_total", "Pages read ahead of use in asynchronous batches."},
+    {"io_requests_total", "Batched I/O requests submitted, after merging adjacent pages."},
+    {"leaf_splits_total", "Leaf node splits."},
+    {"internal_splits_total", "Internal node splits."},
+    {"leaf_merges_total", "Leaf node merges."},
+    {"internal_merges_total", "Internal node merges."},
+    {"leaf_borrows_total", "Cells moved between sibling leaves on delete."},
+    {"internal_borrows_total", "Children redistributed between sibling internal nodes."},
+    {"root_splits_total", "Root splits (tree grew a level)."},
+    {"root_collapses_total", "Root collapses (tree lost a level)."},
+    {"statements_insert_total", "Insert statements executed."},
+    {"statements_select_total", "Select statements executed."},
+    {"statements_delete_total", "Delete statements executed."},
+    {"statements_update_total", "Update statements executed."},
+    {"statements_upsert_total", "Upsert statements executed."},
+    {"rows_returned_total", "Rows returned by select statements."},
+};
+
+static const MetricInfo GAUGE_INFO[NUM_METRIC_GAUGES] = {
+    {"tree_height", "Levels in the B+ tree of the table in use, counting the leaves."},
+    {"file_pages", "Pages in the database file."},
+    {"free_pages", "Pages on the free list."},
+    {"cached_pages", "Pages held in the buffer pool."},
+};
+
+static const MetricInfo HISTOGRAM_INFO[NUM_METRIC_HISTOGRAMS] = {
+    {"page_read_seconds", "Latency of reading one page from the file."},
+    {"page_write_seconds", "Latency of writing one page to the file."},
+    {"statement_insert_seconds", "Latency of insert statements."},
+    {"statement_select_seconds", "Latency of select statements."},
+    {"statement_delete_seconds", "Latency of delete statements."},
+    {"statement_update_seconds", "Latency of update statements."},
+    {"statement_upsert_seconds", "Latency of upsert statements."},
+};
+
+static const char* METRIC_PREFIX = "toydb_";
+
+
+// Upper bound of the bucket holding the requested fraction of observations.
+uint64_t metrics_histogram_percentile(MetricHistogram histogram, double fraction) {
+    Histogram& h = metrics.histograms[histogram];
+    uint64_t count = h.count.load(std::memory_order_relaxed);
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(fraction * count);
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HISTOGRAM_NUM_BUCKETS; i++) {
+        seen += h.buckets[i].load(std::memory_order_relaxed);
+        if (seen > target) {
+            return 2ULL << i;
+        }
+    }
+    return 2ULL << (HISTOGRAM_NUM_BUCKETS - 1);
+}
+
+void metrics_print(std::ostream& out) {
+    for (uint32_t i = 0; i < NUM_METRIC_COUNTERS; i++) {
+        out << COUNTER_INFO[i].name << ": " << metrics.counters[i].load(std::memory_order_relaxed) << std::endl;
+    }
+    for (uint32_t i = 0; i < NUM_METRIC_GAUGES; i++) {
+        out << GAUGE_INFO[i].name << ": " << metrics.gauges[i].load(std::memory_order_relaxed) << std::endl;
+    }
+    for (uint32_t i = 0; i < NUM_METRIC_HISTOGRAMS; i++) {
+        MetricHistogram histogram = (MetricHistogram)i;
+        Histogram& h = metrics.histograms[i];
+        uint64_t count = h.count.load(std::memory_order_relaxed);
+        // Recorded in nanoseconds, printed in seconds as the names say.
+        double average = count ? h.sum_ns.load(std::memory_order_relaxed) / 1e9 / count : 0;
+        out << HISTOGRAM_INFO[i].name << ": count " << count << ", avg " << average << "s"
+            << ", p50 <" << metrics_histogram_percentile(histogram, 0.50) / 1e9 << "s"
+            << ", p99 <" << metrics_histogram_percentile(histogram, 0.99) / 1e9 << "s" << std::endl;
+    }
+}
+
+// Prometheus text exposition format (version 0.0.4).
+std::string metrics_format_prometheus() {
+    std::ostringstream out;
+    for (uint32_t i = 0; i < NUM_METRIC_COUNTERS; i++) {
+        out << "# HELP " << METRIC_PREFIX << COUNTER_INFO[i].name << " " << COUNTER_INFO[i].help << "\n";
+        out << "# TYPE " << METRIC_PREFIX << COUNTER_INFO[i].name << " counter\n";
+        out << METRIC_PREFIX << COUNTER_INFO[i].name << " " << metrics.counters[i].load(std::memory_order_relaxed) << "\n";
+    }
+    for (uint32_t i = 0; i < NUM_METRIC_GAUGES; i++) {
+        out << "# HELP " << METRIC_PREFIX << GAUGE_INFO[i].name << " " << GAUGE_INFO[i].help << "\n";
+        out << "# TYPE " << METRIC_PREFIX << GAUGE_INFO[i].name << " gauge\n";
+        out << METRIC_PREFIX << GAUGE_INFO[i].name << " " << metrics.gauges[i].load(std::memory_order_relaxed) << "\n";
+    }
+    for (uint32_t i = 0; i < NUM_METRIC_HISTOGRAMS; i++) {
+        Histogram& h = metrics.histograms[i];
+        std::string name = std::string(METRIC_PREFIX) + HISTOGRAM_INFO[i].name;
+        out << "# HELP " << name << " " << HISTOGRAM_INFO[i].help << "\n";
+        out << "# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (uint32_t bucket = 0; bucket + 1 < HISTOGRAM_NUM_BUCKETS; bucket++) {
+            cumulative += h.buckets[bucket].load(std::memory_order_relaxed);
+            out << name << "_bucket{le=\"" << (double)(2ULL << bucket) / 1e9 << "\"} " << cumulative << "\n";
+        }
+        uint64_t count = h.count.load(std::memory_order_relaxed);
+        out << name << "_bucket{le=\"+Inf\"} " << count << "\n";
+        out << name << "_sum " << h.sum_ns.load(std::memory_order_relaxed) / 1e9 << "\n";
+        out << name << "_count " << count << "\n";
+    }
+    return out.str();
+}
+
+// Writes the Prometheus dump to `path`. If `path` names a Unix domain
+// socket (e.g. one a collector listens on) the dump is sent over it;
+// otherwise the file is replaced.
+bool metrics_write_prometheus(const std::string& path) {
+    std::string text = metrics_format_prometheus();
+    struct stat path_stat;
+    int fd;
+    if (stat(path.c_str(), &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) {
+        struct sockaddr_un address = {};
+        if (path.size() >= sizeof(address.sun_path)) {
+            std::cerr << "Socket path too long: '" << path << "'" << std::endl;
+            return false;
+        }
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path.c_str());
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd != -1 && connect(fd, (struct sockaddr*)&address, sizeof(address)) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    }
+    if (fd == -1) {
+        std::cerr << "Unable to open '" << path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    size_t written = 0;
+    while (written < text.size()) {
+        ssize_t result = write(fd, text.data() + written, text.size() - written);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result == -1) {
+            std::cerr << "Error writing metrics: " << strerror(errno) << std::endl;
+            close(fd);
+            return false;
+        }
+        written += result;
+    }
+    close(fd);
+    return true;
+}
@@ -0,0 +1,111 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "common.h"
+#include <atomic>
+#include <chrono>
+
+// --- Engine-Wide Metrics Registry ---
+// A fixed set of process-wide counters, gauges and latency histograms. All
+// updates are relaxed atomic adds, so instrumenting a hot path costs a few
+// nanoseconds and never takes a lock.
+
+enum MetricCounter {
+    METRIC_BUFFER_HITS,
+    METRIC_BUFFER_MISSES,
+    METRIC_PAGES_READ,
+    METRIC_PAGES_WRITTEN,
+    METRIC_BYTES_READ,
+    METRIC_BYTES_WRITTEN,
+    METRIC_PAGES_ALLOCATED,
+    METRIC_PAGES_FREED,
+    METRIC_PAGES_EVICTED,
+    METRIC_PAGES_PREFETCHED,
+    METRIC_IO_REQUESTS,
+    METRIC_LEAF_SPLITS,
+    METRIC_INTERNAL_SPLITS,
+    METRIC_LEAF_MERGES,
+    METRIC_INTERNAL_MERGES,
+    METRIC_LEAF_BORROWS,
+    METRIC_INTERNAL_BORROWS,
+    METRIC_ROOT_SPLITS,
+    METRIC_ROOT_COLLAPSES,
+    METRIC_STATEMENTS_INSERT,
+    METRIC_STATEMENTS_SELECT,
+    METRIC_STATEMENTS_DELETE,
+    METRIC_STATEMENTS_UPDATE,
+    METRIC_STATEMENTS_UPSERT,
+    METRIC_ROWS_RETURNED,
+    NUM_METRIC_COUNTERS
+};
+
+enum MetricGauge {
+    METRIC_GAUGE_TREE_HEIGHT,
+    METRIC_GAUGE_FILE_PAGES,
+    METRIC_GAUGE_FREE_PAGES,
+    METRIC_GAUGE_CACHED_PAGES,
+    NUM_METRIC_GAUGES
+};
+
+enum MetricHistogram {
+    HISTOGRAM_PAGE_READ,
+    HISTOGRAM_PAGE_WRITE,
+    HISTOGRAM_STATEMENT_INSERT,
+    HISTOGRAM_STATEMENT_SELECT,
+    HISTOGRAM_STATEMENT_DELETE,
+    HISTOGRAM_STATEMENT_UPDATE,
+    HISTOGRAM_STATEMENT_UPSERT,
+    NUM_METRIC_HISTOGRAMS
+};
+
+// Bucket i counts observations in [2^i, 2^(i+1)) nanoseconds; the last
+// bucket also takes everything slower.
+const uint32_t HISTOGRAM_NUM_BUCKETS = 36;
+
+struct Histogram {
+    std::atomic<uint64_t> buckets[HISTOGRAM_NUM_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum_ns;
+};
+
+struct Metrics {
+    std::atomic<uint64_t> counters[NUM_METRIC_COUNTERS];
+    std::atomic<int64_t> gauges[NUM_METRIC_GAUGES];
+    Histogram histograms[NUM_METRIC_HISTOGRAMS];
+};
+
+extern Metrics metrics;
+
+inline void metrics_increment(MetricCounter counter, uint64_t amount = 1) {
+    metrics.counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+inline uint64_t metrics_counter(MetricCounter counter) {
+    return metrics.counters[counter].load(std::memory_order_relaxed);
+}
+inline void metrics_gauge_set(MetricGauge gauge, int64_t value) {
+    metrics.gauges[gauge].store(value, std::memory_order_relaxed);
+}
+inline void metrics_gauge_add(MetricGauge gauge, int64_t delta) {
+    metrics.gauges[gauge].fetch_add(delta, std::memory_order_relaxed);
+}
+inline uint64_t metrics_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+inline void metrics_observe(MetricHistogram histogram, uint64_t nanoseconds) {
+    Histogram& h = metrics.histograms[histogram];
+    uint32_t bucket = nanoseconds == 0 ? 0 : 63 - __builtin_clzll(nanoseconds);
+    if (bucket >= HISTOGRAM_NUM_BUCKETS) {
+        bucket = HISTOGRAM_NUM_BUCKETS - 1;
+    }
+    h.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    h.count.fetch_add(1, std::memory_order_relaxed);
+    h.sum_ns.fetch_add(nanoseconds, std::memory_order_relaxed);
+}
+
+uint64_t metrics_histogram_percentile(MetricHistogram histogram, double fraction);
+void metrics_print(std::ostream& out);
+std::string metrics_format_prometheus();
+bool metrics_write_prometheus(const std::string& path);
+
+#endif // METRICS_H
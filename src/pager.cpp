@@ -1,6 +1,60 @@
 #include "pager.h"
+#include "metrics.h"
+#include "explain.h"
+#include "compress.h"
+#include <algorithm>
+#include <sys/mman.h>
 
-Pager* pager_open(const std::string& filename) {
+static void* pager_fetch(Pager* pager, uint32_t page_num, bool for_write, uint32_t* frame_out);
+static void* pager_use_frame(Pager* pager, uint32_t frame_index, bool for_write, bool hit, bool allocated);
+static void pager_swizzle(Pager* pager, uint32_t parent_index, uint32_t child_index, uint32_t child_frame);
+static void pager_unswizzle(Pager* pager, uint32_t frame_index);
+static void pager_unswizzle_parent(Pager* pager, uint32_t frame_index);
+static void* mmap_fetch(Pager* pager, uint32_t page_num, bool for_write);
+static uint32_t free_list_pop(Pager* pager);
+static void* free_list_page(Pager* pager, uint32_t page_num);
+static void pager_mark_free(Pager* pager, uint32_t page_num, bool is_free);
+static void mmap_open(Pager* pager);
+static void mmap_grow(Pager* pager, uint64_t required_length);
+static uint32_t pager_allocate_frame(Pager* pager);
+static void lru_unlink(Pager* pager, uint32_t frame_index);
+static void lru_push_front(Pager* pager, uint32_t frame_index);
+static void read_page(Pager* pager, uint32_t page_num, void* destination);
+static void write_page(Pager* pager, uint32_t page_num, const void* source);
+static void arena_open(Pager* pager, bool huge_pages);
+static void* pager_alloc_buffer(Pager* pager);
+static void pager_free_buffer(Pager* pager, void* buffer);
+static void pager_submit_frames(Pager* pager, std::vector<uint32_t>& frame_indices, bool is_write);
+static void pager_wait_frame(Pager* pager, uint32_t frame_index);
+static void pager_retire_io(Pager* pager, bool wait);
+static void pager_finish_read(Pager* pager, uint32_t frame_index);
+static uint64_t read_fully(Pager* pager, void* destination, uint64_t length, uint64_t offset);
+static void write_fully(Pager* pager, const void* source, uint64_t length, uint64_t offset);
+static void map_load(Pager* pager, const DatabaseHeader& header);
+static void map_save(Pager* pager);
+static const char* compress_page(Pager* pager, const void* page, char* buffer, uint32_t* length);
+static void decompress_page(Pager* pager, uint32_t page_num, char* page, uint32_t length);
+static uint64_t extent_assign(Pager* pager, uint32_t page_num, uint32_t length);
+static uint64_t extent_allocate(Pager* pager, uint32_t sectors);
+static void extent_free_range(Pager* pager, uint64_t offset, uint64_t length);
+
+
+bool pager_valid_page_size(uint32_t page_size) {
+    return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE && (page_size & (page_size - 1)) == 0;
+}
+
+bool parse_pager_backend(const std::string& name, PagerBackend* backend) {
+    if (name == "buffered") {
+        *backend = PAGER_BACKEND_BUFFERED;
+    } else if (name == "mmap") {
+        *backend = PAGER_BACKEND_MMAP;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+Pager* pager_open(const std::string& filename, const PagerOptions& options) {
     int fd = open(filename.c_str(), O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
     if (fd == -1) {
         std::cerr << "Unable to open file '" << filename << "'" << std::endl;
@@ -11,75 +65,1127 @@ Pager* pager_open(const std::string& filename) {
     Pager* pager = new Pager();
     pager->file_descriptor = fd;
     pager->file_length = file_length;
-    pager->num_pages = (file_length / PAGE_SIZE);
+    pager->backend = options.backend;
+    pager->readahead_window = options.readahead_window;
+    pager->warm_list_path = filename + WARM_LIST_SUFFIX;
+    pager->lru_head = NO_FRAME;
+    pager->lru_tail = NO_FRAME;
+    pager->epoch = 1;
+    pager->trace = nullptr;
 
-    if (file_length % PAGE_SIZE != 0) {
-        std::cerr << "Db file is not a whole number of pages. Corrupt file." << std::endl;
+    // The header has to be read before any page, since it fixes their size.
+    // `options.page_size` is used when the file is new.
+    uint32_t page_size = options.page_size;
+    DatabaseHeader header = {};
+    if (file_length > 0 && pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)) {
+        std::cerr << "Error reading file header: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    pager->format_version = DB_FORMAT_VERSION;
+    if (file_length == 0) {
+        pager->is_legacy_format = false;
+    } else if (memcmp(header.magic, DB_FILE_MAGIC, sizeof(DB_FILE_MAGIC)) != 0) {
+        // Files from before the header always used 4 KiB pages and
+        // interleaved leaves.
+        pager->is_legacy_format = true;
+        pager->format_version = DB_FORMAT_VERSION_INTERLEAVED_LEAVES;
+        page_size = DEFAULT_PAGE_SIZE;
+    } else if (header.format_version != DB_FORMAT_VERSION &&
+               header.format_version != DB_FORMAT_VERSION_UNPACKED_INTERNAL_KEYS &&
+               header.format_version != DB_FORMAT_VERSION_UNPACKED_KEYS &&
+               header.format_version != DB_FORMAT_VERSION_TEXT_CATALOG &&
+               header.format_version != DB_FORMAT_VERSION_SINGLE_TABLE &&
+               header.format_version != DB_FORMAT_VERSION_FORWARD_LINKED_LEAVES &&
+               header.format_version != DB_FORMAT_VERSION_INTERLEAVED_LEAVES) {
+        std::cerr << "Unsupported database format version " << header.format_version << "." << std::endl;
+        exit(EXIT_FAILURE);
+    } else {
+        pager->format_version = header.format_version;
+        page_size = header.page_size;
+    }
+    if (!pager_valid_page_size(page_size)) {
+        std::cerr << "Invalid page size " << page_size << "." << std::endl;
         exit(EXIT_FAILURE);
     }
+    pager->page_size = page_size;
+    pager->num_pages = (file_length / page_size);
+    pager->capacity = PAGER_CACHE_BYTES / page_size;
+    pager->compressed = file_length == 0 ? options.compress
+                                         : !pager->is_legacy_format && (header.flags & DB_FLAG_COMPRESSED) != 0;
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        pager->pages[i] = nullptr;
+    if (pager->compressed) {
+        if (pager->backend == PAGER_BACKEND_MMAP || options.direct_io) {
+            std::cerr << "Compressed databases cannot use the mmap backend or O_DIRECT." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        map_load(pager, header);
+    } else if (file_length % page_size != 0) {
+        std::cerr << "Db file is not a whole number of pages. Corrupt file." << std::endl;
+        exit(EXIT_FAILURE);
     }
 
+    metrics_gauge_set(METRIC_GAUGE_FILE_PAGES, pager->num_pages);
+    metrics_gauge_set(METRIC_GAUGE_CACHED_PAGES, 0);
+
+    if (pager->backend == PAGER_BACKEND_MMAP) {
+        if (options.direct_io) {
+            std::cerr << "O_DIRECT cannot be combined with the mmap backend." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        mmap_open(pager);
+    } else {
+        arena_open(pager, options.huge_pages);
+        // Enabled only now: the header above was read with an unaligned
+        // buffer, which O_DIRECT would reject.
+        if (options.direct_io && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_DIRECT) == -1) {
+            std::cerr << "Unable to enable O_DIRECT on '" << filename << "': " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        pager->direct_io = options.direct_io;
+        pager->io = io_queue_open(fd, options.io_backend);
+    }
+    if (pager->num_pages == 0) {
+        pager_initialize_header(pager);
+    }
     return pager;
 }
 
-void* get_page(Pager* pager, uint32_t page_num) {
-    if (page_num >= TABLE_MAX_PAGES) {
-        std::cerr << "Tried to fetch page number out of bounds. " << page_num << " >= " << TABLE_MAX_PAGES << std::endl;
+void pager_close(Pager* pager) {
+    pager_flush_all(pager);
+    if (pager->io != nullptr) {
+        io_queue_close(pager->io);
+    }
+    for (Frame& frame : pager->frames) {
+        pager_free_buffer(pager, frame.data);
+    }
+    if (pager->arena != nullptr) {
+        munmap(pager->arena, pager->arena_size);
+    }
+    metrics_gauge_set(METRIC_GAUGE_CACHED_PAGES, 0);
+
+    if (pager->backend == PAGER_BACKEND_MMAP) {
+        munmap(pager->map_base, PAGER_MMAP_RESERVE_BYTES);
+        // Drop the unused tail of the last chunk.
+        if (ftruncate(pager->file_descriptor, (off_t)pager->num_pages * pager->page_size) == -1) {
+            std::cerr << "Error truncating db file: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    int result = close(pager->file_descriptor);
+    if (result == -1) {
+        std::cerr << "Error closing db file." << std::endl;
         exit(EXIT_FAILURE);
     }
+    delete pager;
+}
+
+// Starts a new unit of work: pages fetched before this call may now be
+// evicted, so callers must not keep page pointers across it. Also moves
+// queued reads along, so a long prefetch (such as the warm-up after open)
+// keeps progressing while statements run.
+void pager_begin_operation(Pager* pager) {
+    pager->epoch++;
+    if (!pager->io_requests.empty()) {
+        io_poll(pager->io);
+    }
+}
+
+void* get_page(Pager* pager, uint32_t page_num) {
+    return pager_fetch(pager, page_num, true, nullptr);
+}
+
+// Same as get_page for callers that will not modify the page, which lets
+// the frame stay clean and skip its write-back.
+void* get_page_for_read(Pager* pager, uint32_t page_num) {
+    return pager_fetch(pager, page_num, false, nullptr);
+}
+
+// The page if it is already in memory, else nullptr. Nothing is read, and
+// neither the LRU order nor the buffer-pool metrics change.
+void* pager_cached_page(Pager* pager, uint32_t page_num) {
+    if (pager->backend == PAGER_BACKEND_MMAP) {
+        return page_num < pager->num_pages ? pager->map_base + (uint64_t)page_num * pager->page_size : nullptr;
+    }
+    auto found = pager->page_table.find(page_num);
+    if (found == pager->page_table.end() || pager->frames[found->second].io_request != nullptr) {
+        return nullptr;
+    }
+    return pager->frames[found->second].data;
+}
 
-    if (pager->pages[page_num] == nullptr) {
-        void* page = malloc(PAGE_SIZE);
-        uint32_t num_pages_on_disk = pager->file_length / PAGE_SIZE;
+// --- Swizzled Descents ---
+// Read-only root-to-leaf walks go through these two calls, which thread the
+// current frame index along. Once a child has been found through the page
+// table, its frame is cached in the parent's frame, so later descents
+// through resident upper levels skip the hash lookup. The mmap backend has
+// no frames and reports NO_FRAME.
+void* pager_descend_root(Pager* pager, uint32_t page_num, uint32_t* frame_index) {
+    *frame_index = NO_FRAME;
+    return pager_fetch(pager, page_num, false, frame_index);
+}
 
-        if (pager->file_length % PAGE_SIZE) {
-            num_pages_on_disk += 1;
+void* pager_descend(Pager* pager, uint32_t* frame_index, uint32_t child_index, uint32_t child_page_num) {
+    uint32_t parent_index = *frame_index;
+    if (parent_index == NO_FRAME) {
+        return pager_fetch(pager, child_page_num, false, frame_index);
+    }
+    const std::vector<uint32_t>& children = pager->frames[parent_index].children;
+    if (child_index < children.size()) {
+        uint32_t child_frame = children[child_index];
+        if (child_frame != NO_FRAME && pager->frames[child_frame].page_num == child_page_num) {
+            *frame_index = child_frame;
+            return pager_use_frame(pager, child_frame, false, true, false);
         }
+    }
+    void* page = pager_fetch(pager, child_page_num, false, frame_index);
+    // The parent was fetched in this operation, so it cannot have been
+    // evicted to make room for the child.
+    pager_swizzle(pager, parent_index, child_index, *frame_index);
+    return page;
+}
 
-        if (page_num < num_pages_on_disk) {
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
-            if (bytes_read == -1) {
-                std::cerr << "Error reading file: " << strerror(errno) << std::endl;
-                exit(EXIT_FAILURE);
-            }
+static void pager_swizzle(Pager* pager, uint32_t parent_index, uint32_t child_index, uint32_t child_frame) {
+    if (pager->frames[child_frame].swizzled_by != NO_FRAME) {
+        pager_unswizzle_parent(pager, child_frame);
+    }
+    std::vector<uint32_t>& children = pager->frames[parent_index].children;
+    if (children.size() <= child_index) {
+        children.resize(child_index + 1, NO_FRAME);
+    }
+    if (children[child_index] != NO_FRAME) {
+        pager->frames[children[child_index]].swizzled_by = NO_FRAME;
+    }
+    children[child_index] = child_frame;
+    pager->frames[child_frame].swizzled_by = parent_index;
+    pager->frames[child_frame].swizzled_index = child_index;
+}
+
+// Clears the parent entry pointing at this frame, if it still does.
+static void pager_unswizzle_parent(Pager* pager, uint32_t frame_index) {
+    Frame& frame = pager->frames[frame_index];
+    std::vector<uint32_t>& siblings = pager->frames[frame.swizzled_by].children;
+    if (frame.swizzled_index < siblings.size() && siblings[frame.swizzled_index] == frame_index) {
+        siblings[frame.swizzled_index] = NO_FRAME;
+    }
+    frame.swizzled_by = NO_FRAME;
+}
+
+// Drops every swizzled pointer to and from a frame that is being evicted.
+static void pager_unswizzle(Pager* pager, uint32_t frame_index) {
+    if (pager->frames[frame_index].swizzled_by != NO_FRAME) {
+        pager_unswizzle_parent(pager, frame_index);
+    }
+    for (uint32_t child_frame : pager->frames[frame_index].children) {
+        if (child_frame != NO_FRAME && pager->frames[child_frame].swizzled_by == frame_index) {
+            pager->frames[child_frame].swizzled_by = NO_FRAME;
+        }
+    }
+    pager->frames[frame_index].children.clear();
+}
+
+static void* pager_fetch(Pager* pager, uint32_t page_num, bool for_write, uint32_t* frame_out) {
+    if (page_num == UINT32_MAX) {
+        std::cerr << "Tried to fetch page number out of bounds. " << page_num << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (pager->backend == PAGER_BACKEND_MMAP) {
+        return mmap_fetch(pager, page_num, for_write);
+    }
+
+    bool hit = true;
+    bool allocated = false;
+    uint32_t frame_index;
+    auto found = pager->page_table.find(page_num);
+    if (found != pager->page_table.end()) {
+        frame_index = found->second;
+    } else {
+        hit = false;
+        metrics_increment(METRIC_BUFFER_MISSES);
+        frame_index = pager_allocate_frame(pager);
+        Frame& frame = pager->frames[frame_index];
+        frame.page_num = page_num;
+        frame.dirty = false;
+        frame.uses = 0;
+        frame.is_free = false;
+
+        if (page_num < pager->num_pages && (uint64_t)page_num * pager->page_size < pager->file_length) {
+            read_page(pager, page_num, frame.data);
         } else {
             // This is a new page. Initialize it to all zeros.
-            memset(page, 0, PAGE_SIZE);
+            memset(frame.data, 0, pager->page_size);
+            frame.dirty = true;
+            allocated = true;
         }
-
-        pager->pages[page_num] = page;
+        pager->page_table[page_num] = frame_index;
 
         if (page_num >= pager->num_pages) {
             pager->num_pages = page_num + 1;
+            metrics_increment(METRIC_PAGES_ALLOCATED);
+            metrics_gauge_set(METRIC_GAUGE_FILE_PAGES, pager->num_pages);
+        }
+    }
+
+    if (frame_out != nullptr) {
+        *frame_out = frame_index;
+    }
+    return pager_use_frame(pager, frame_index, for_write, hit, allocated);
+}
+
+// Marks a frame used by the current operation and moves it to the front of
+// the LRU list. On a hit, first waits for any prefetch still filling it.
+static void* pager_use_frame(Pager* pager, uint32_t frame_index, bool for_write, bool hit, bool allocated) {
+    if (hit) {
+        if (pager->frames[frame_index].io_request != nullptr) {
+            pager_wait_frame(pager, frame_index);
+        }
+        lru_unlink(pager, frame_index);
+        metrics_increment(METRIC_BUFFER_HITS);
+    }
+    Frame& frame = pager->frames[frame_index];
+    frame.epoch = pager->epoch;
+    frame.dirty = frame.dirty || for_write;
+    frame.uses++;
+    lru_push_front(pager, frame_index);
+
+    if (pager->trace != nullptr) {
+        explain_record_page(pager->trace, frame.page_num, frame.data, hit, allocated, for_write);
+    }
+    return frame.data;
+}
+
+// Pages are addressed directly in the mapping; writes reach the file
+// through the kernel page cache, so there is nothing to track per page.
+static void* mmap_fetch(Pager* pager, uint32_t page_num, bool for_write) {
+    uint64_t offset = (uint64_t)page_num * pager->page_size;
+    bool allocated = page_num >= pager->num_pages;
+    if (offset + pager->page_size > pager->file_length) {
+        mmap_grow(pager, offset + pager->page_size);
+    }
+    if (allocated) {
+        pager->num_pages = page_num + 1;
+        metrics_increment(METRIC_PAGES_ALLOCATED);
+        metrics_gauge_set(METRIC_GAUGE_FILE_PAGES, pager->num_pages);
+    }
+    metrics_increment(METRIC_BUFFER_HITS);
+
+    void* page = pager->map_base + offset;
+    if (pager->trace != nullptr) {
+        explain_record_page(pager->trace, page_num, page, true, allocated, for_write);
+    }
+    return page;
+}
+
+static void mmap_open(Pager* pager) {
+    void* base = mmap(nullptr, PAGER_MMAP_RESERVE_BYTES, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        std::cerr << "Unable to reserve address space for mmap: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    pager->map_base = (char*)base;
+    pager->access_pattern = ACCESS_NORMAL;
+    if (pager->file_length > PAGER_MMAP_RESERVE_BYTES) {
+        std::cerr << "Db file is too large for the mmap backend." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (pager->file_length > 0 &&
+        mmap(pager->map_base, pager->file_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             pager->file_descriptor, 0) == MAP_FAILED) {
+        std::cerr << "Unable to mmap db file: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Extends the file to the next chunk boundary past `required_length` and
+// maps the new range right after the existing mapping.
+static void mmap_grow(Pager* pager, uint64_t required_length) {
+    uint64_t new_length = (required_length + PAGER_MMAP_CHUNK_BYTES - 1) / PAGER_MMAP_CHUNK_BYTES * PAGER_MMAP_CHUNK_BYTES;
+    if (new_length > PAGER_MMAP_RESERVE_BYTES) {
+        std::cerr << "Db file is too large for the mmap backend." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(pager->file_descriptor, new_length) == -1) {
+        std::cerr << "Error extending db file: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    uint64_t old_length = pager->file_length;
+    if (mmap(pager->map_base + old_length, new_length - old_length, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+             pager->file_descriptor, old_length) == MAP_FAILED) {
+        std::cerr << "Unable to mmap db file: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    pager->file_length = new_length;
+    if (pager->access_pattern != ACCESS_NORMAL) {
+        PagerAccessPattern pattern = pager->access_pattern;
+        pager->access_pattern = ACCESS_NORMAL;
+        pager_advise(pager, pattern);
+    }
+}
+
+// Tells the kernel how the mapping is about to be read. Only issues a
+// syscall when the pattern changes; a no-op for the buffered backend.
+void pager_advise(Pager* pager, PagerAccessPattern pattern) {
+    if (pager->backend != PAGER_BACKEND_MMAP || pattern == pager->access_pattern || pager->file_length == 0) {
+        return;
+    }
+    int advice = MADV_NORMAL;
+    if (pattern == ACCESS_RANDOM) {
+        advice = MADV_RANDOM;
+    } else if (pattern == ACCESS_SEQUENTIAL) {
+        advice = MADV_SEQUENTIAL;
+    }
+    madvise(pager->map_base, pager->file_length, advice);
+    pager->access_pattern = pattern;
+}
+
+// Reserves the arena for the pool's frames. With `huge_pages` it first
+// asks for explicit huge pages and otherwise settles for transparent ones.
+static void arena_open(Pager* pager, bool huge_pages) {
+    uint64_t size = (uint64_t)pager->capacity * pager->page_size;
+    void* arena = MAP_FAILED;
+    if (huge_pages) {
+        size = (size + PAGER_HUGE_PAGE_SIZE - 1) / PAGER_HUGE_PAGE_SIZE * PAGER_HUGE_PAGE_SIZE;
+        arena = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (arena == MAP_FAILED) {
+        arena = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (arena != MAP_FAILED && huge_pages) {
+            madvise(arena, size, MADV_HUGEPAGE);
+        }
+    }
+    if (arena == MAP_FAILED) {
+        std::cerr << "Unable to allocate the buffer pool: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    pager->arena = (char*)arena;
+    pager->arena_size = size;
+    pager->arena_used = 0;
+}
+
+// Frames past the pool's capacity (see pager_begin_operation) get their
+// own aligned allocation once the arena is used up.
+static void* pager_alloc_buffer(Pager* pager) {
+    if (pager->arena_used + pager->page_size <= pager->arena_size) {
+        void* buffer = pager->arena + pager->arena_used;
+        pager->arena_used += pager->page_size;
+        return buffer;
+    }
+    void* buffer = nullptr;
+    if (posix_memalign(&buffer, PAGER_BUFFER_ALIGNMENT, pager->page_size) != 0) {
+        std::cerr << "Unable to allocate a page buffer." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return buffer;
+}
+
+static void pager_free_buffer(Pager* pager, void* buffer) {
+    char* address = (char*)buffer;
+    if (address < pager->arena || address >= pager->arena + pager->arena_size) {
+        free(buffer);
+    }
+}
+
+// Returns a free frame, evicting the least recently used page when the pool
+// is full. Pages touched in the current operation are never evicted.
+static uint32_t pager_allocate_frame(Pager* pager) {
+    uint32_t victim = pager->lru_tail;
+    if (pager->frames.size() < pager->capacity || victim == NO_FRAME ||
+        pager->frames[victim].epoch == pager->epoch) {
+        Frame frame = {};
+        frame.data = pager_alloc_buffer(pager);
+        frame.swizzled_by = NO_FRAME;
+        pager->frames.push_back(frame);
+        metrics_gauge_set(METRIC_GAUGE_CACHED_PAGES, pager->frames.size());
+        return pager->frames.size() - 1;
+    }
+
+    if (pager->frames[victim].io_request != nullptr) {
+        pager_wait_frame(pager, victim);
+    }
+    Frame& frame = pager->frames[victim];
+    if (frame.dirty) {
+        write_page(pager, frame.page_num, frame.data);
+    }
+    lru_unlink(pager, victim);
+    pager_unswizzle(pager, victim);
+    pager->page_table.erase(frame.page_num);
+    metrics_increment(METRIC_PAGES_EVICTED);
+    return victim;
+}
+
+static void lru_unlink(Pager* pager, uint32_t frame_index) {
+    Frame& frame = pager->frames[frame_index];
+    if (frame.lru_prev != NO_FRAME) {
+        pager->frames[frame.lru_prev].lru_next = frame.lru_next;
+    } else {
+        pager->lru_head = frame.lru_next;
+    }
+    if (frame.lru_next != NO_FRAME) {
+        pager->frames[frame.lru_next].lru_prev = frame.lru_prev;
+    } else {
+        pager->lru_tail = frame.lru_prev;
+    }
+}
+
+static void lru_push_front(Pager* pager, uint32_t frame_index) {
+    Frame& frame = pager->frames[frame_index];
+    frame.lru_prev = NO_FRAME;
+    frame.lru_next = pager->lru_head;
+    if (pager->lru_head != NO_FRAME) {
+        pager->frames[pager->lru_head].lru_prev = frame_index;
+    }
+    pager->lru_head = frame_index;
+    if (pager->lru_tail == NO_FRAME) {
+        pager->lru_tail = frame_index;
+    }
+}
+
+// Offsets are computed in 64 bits, so files can grow past 4 GiB; with
+// 32-bit page numbers the limit is 2^32 pages (16 TiB at 4 KiB pages).
+static void read_page(Pager* pager, uint32_t page_num, void* destination) {
+    uint64_t start_ns = metrics_now_ns();
+    uint64_t bytes_read;
+    if (pager->compressed && page_num != DB_HEADER_PAGE_NUM) {
+        PageExtent extent = page_num < pager->extents.size() ? pager->extents[page_num] : PageExtent{};
+        bytes_read = extent.offset == 0 ? 0 : read_fully(pager, destination, extent.length, extent.offset);
+        if (bytes_read != extent.length) {
+            std::cerr << "Compressed page " << page_num << " lies past the end of the file. Corrupt file." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (extent.offset == 0) {
+            memset(destination, 0, pager->page_size);
+        } else {
+            decompress_page(pager, page_num, (char*)destination, extent.length);
+        }
+    } else {
+        bytes_read = read_fully(pager, destination, pager->page_size, (uint64_t)page_num * pager->page_size);
+        // Short file: the rest of the page was never written.
+        memset((char*)destination + bytes_read, 0, pager->page_size - bytes_read);
+    }
+    metrics_observe(HISTOGRAM_PAGE_READ, metrics_now_ns() - start_ns);
+    metrics_increment(METRIC_PAGES_READ);
+    metrics_increment(METRIC_BYTES_READ, bytes_read);
+}
+
+static void write_page(Pager* pager, uint32_t page_num, const void* source) {
+    uint64_t start_ns = metrics_now_ns();
+    uint32_t length = pager->page_size;
+    if (pager->compressed && page_num != DB_HEADER_PAGE_NUM) {
+        const char* data = compress_page(pager, source, pager->compress_buffer.data(), &length);
+        write_fully(pager, data, length, extent_assign(pager, page_num, length));
+    } else {
+        write_fully(pager, source, length, (uint64_t)page_num * pager->page_size);
+    }
+    pager->file_length = std::max<uint64_t>(pager->file_length, ((uint64_t)page_num + 1) * pager->page_size);
+    metrics_observe(HISTOGRAM_PAGE_WRITE, metrics_now_ns() - start_ns);
+    metrics_increment(METRIC_PAGES_WRITTEN);
+    metrics_increment(METRIC_BYTES_WRITTEN, length);
+}
+
+// Reads until `length` bytes are in or the file ends; returns the count.
+static uint64_t read_fully(Pager* pager, void* destination, uint64_t length, uint64_t offset) {
+    uint64_t bytes_read = 0;
+    while (bytes_read < length) {
+        ssize_t result = pread(pager->file_descriptor, (char*)destination + bytes_read, length - bytes_read, offset + bytes_read);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result == -1) {
+            std::cerr << "Error reading file: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        if (result == 0) {
+            break;
+        }
+        bytes_read += result;
+    }
+    return bytes_read;
+}
+
+static void write_fully(Pager* pager, const void* source, uint64_t length, uint64_t offset) {
+    uint64_t bytes_written = 0;
+    while (bytes_written < length) {
+        ssize_t result = pwrite(pager->file_descriptor, (const char*)source + bytes_written, length - bytes_written, offset + bytes_written);
+        if (result == -1 && errno == EINTR) {
+            continue;
         }
+        if (result == -1) {
+            std::cerr << "Error writing to file: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        bytes_written += result;
     }
-    return pager->pages[page_num];
 }
 
 void pager_flush(Pager* pager, uint32_t page_num) {
-    if (pager->pages[page_num] == nullptr) {
+    if (pager->backend == PAGER_BACKEND_MMAP) {
+        if (msync(pager->map_base + (uint64_t)page_num * pager->page_size, pager->page_size, MS_SYNC) == -1) {
+            std::cerr << "Error syncing page: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    auto found = pager->page_table.find(page_num);
+    if (found == pager->page_table.end()) {
         std::cerr << "Tried to flush null page." << std::endl;
         exit(EXIT_FAILURE);
     }
+    Frame& frame = pager->frames[found->second];
+    write_page(pager, page_num, frame.data);
+    frame.dirty = false;
+}
 
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-    if (offset == -1) {
-        std::cerr << "Error seeking: " << strerror(errno) << std::endl;
-        exit(EXIT_FAILURE);
+// Writes every dirty page. The writes go out as one batch in file order,
+// adjacent pages merged, so the device sees a deep queue of large requests.
+// A compressed file then saves its page map, and its header goes last so
+// it only ever points at a complete map.
+void pager_flush_all(Pager* pager) {
+    if (pager->backend == PAGER_BACKEND_MMAP) {
+        if (pager->file_length > 0 && msync(pager->map_base, pager->file_length, MS_SYNC) == -1) {
+            std::cerr << "Error syncing db file: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    pager_complete_io(pager);
+    std::vector<uint32_t> dirty_frames;
+    for (uint32_t i = 0; i < pager->frames.size(); i++) {
+        if (pager->frames[i].dirty && !(pager->compressed && pager->frames[i].page_num == DB_HEADER_PAGE_NUM)) {
+            dirty_frames.push_back(i);
+        }
+    }
+    pager_submit_frames(pager, dirty_frames, true);
+    pager_complete_io(pager);
+    for (uint32_t frame_index : dirty_frames) {
+        pager->frames[frame_index].dirty = false;
+    }
+    if (!pager->compressed) {
+        return;
+    }
+    if (pager->map_dirty) {
+        map_save(pager);
+    }
+    auto found = pager->page_table.find(DB_HEADER_PAGE_NUM);
+    if (found != pager->page_table.end() && pager->frames[found->second].dirty) {
+        write_page(pager, DB_HEADER_PAGE_NUM, pager->frames[found->second].data);
+        pager->frames[found->second].dirty = false;
+    }
+}
+
+// Starts reading the given pages into the pool and returns without waiting;
+// a later get_page on one of them waits for the batch. Pages that are
+// cached or not yet in the file are skipped.
+void pager_prefetch(Pager* pager, const uint32_t* page_nums, uint32_t num_pages) {
+    if (pager->backend == PAGER_BACKEND_MMAP) {
+        for (uint32_t i = 0; i < num_pages; i++) {
+            uint64_t offset = (uint64_t)page_nums[i] * pager->page_size;
+            if (offset + pager->page_size <= pager->file_length) {
+                madvise(pager->map_base + offset, pager->page_size, MADV_WILLNEED);
+            }
+        }
+        return;
+    }
+
+    // Never let a prefetch push out more than half of the pool, but do fill
+    // frames that are still free.
+    pager_retire_io(pager, false);
+    uint32_t limit = pager->capacity / 2;
+    if (pager->frames.size() < pager->capacity) {
+        limit = std::max<uint32_t>(limit, pager->capacity - pager->frames.size());
+    }
+    std::vector<uint32_t> frame_indices;
+    for (uint32_t i = 0; i < num_pages && frame_indices.size() < limit; i++) {
+        uint32_t page_num = page_nums[i];
+        if (page_num >= pager->num_pages || (uint64_t)page_num * pager->page_size >= pager->file_length ||
+            pager->page_table.count(page_num) != 0) {
+            continue;
+        }
+        uint32_t frame_index = pager_allocate_frame(pager);
+        Frame& frame = pager->frames[frame_index];
+        frame.page_num = page_num;
+        frame.dirty = false;
+        frame.io_request = nullptr;
+        frame.uses = 0;
+        frame.is_free = false;
+        // Keeps the rest of this batch from evicting it before submission.
+        frame.epoch = pager->epoch;
+        pager->page_table[page_num] = frame_index;
+        lru_push_front(pager, frame_index);
+        frame_indices.push_back(frame_index);
+    }
+    if (frame_indices.empty()) {
+        return;
+    }
+    metrics_increment(METRIC_PAGES_PREFETCHED, frame_indices.size());
+    pager_submit_frames(pager, frame_indices, false);
+}
+
+// Sorts the frames by page number, merges runs of adjacent pages into
+// vectored requests and submits them all at once. Compressed pages sit in
+// extents of their own and go out one request each: writes from
+// compress_staging, which the caller must not touch until they complete,
+// and reads into the frame, expanded by pager_finish_read.
+static void pager_submit_frames(Pager* pager, std::vector<uint32_t>& frame_indices, bool is_write) {
+    std::sort(frame_indices.begin(), frame_indices.end(), [pager](uint32_t a, uint32_t b) {
+        return pager->frames[a].page_num < pager->frames[b].page_num;
+    });
+    if (pager->compressed && is_write) {
+        pager->compress_staging.resize((size_t)frame_indices.size() * pager->page_size);
+    }
+    std::vector<IoRequest*> batch;
+    uint32_t previous_page_num = 0;
+    for (uint32_t frame_index : frame_indices) {
+        Frame& frame = pager->frames[frame_index];
+        if (pager->compressed) {
+            uint32_t length = pager->page_size;
+            const char* data = (const char*)frame.data;
+            uint64_t offset;
+            if (is_write) {
+                char* staging = pager->compress_staging.data() + (size_t)batch.size() * pager->page_size;
+                data = compress_page(pager, frame.data, staging, &length);
+                offset = extent_assign(pager, frame.page_num, length);
+            } else {
+                PageExtent extent = frame.page_num < pager->extents.size() ? pager->extents[frame.page_num] : PageExtent{};
+                if (extent.offset == 0) {
+                    memset(frame.data, 0, pager->page_size);
+                    continue;
+                }
+                offset = extent.offset;
+                length = extent.length;
+            }
+            IoRequest* request = new IoRequest();
+            request->is_write = is_write;
+            request->offset = offset;
+            request->user_data = frame.page_num;
+            request->iov.push_back({(void*)data, length});
+            request->length = length;
+            if (!is_write) {
+                frame.io_request = request;
+            }
+            batch.push_back(request);
+            continue;
+        }
+
+        IoRequest* request = batch.empty() ? nullptr : batch.back();
+        if (request == nullptr || frame.page_num != previous_page_num + 1 || request->iov.size() >= PAGER_IO_MAX_COALESCE) {
+            request = new IoRequest();
+            request->is_write = is_write;
+            request->offset = (uint64_t)frame.page_num * pager->page_size;
+            request->user_data = frame.page_num;
+            batch.push_back(request);
+        }
+        request->iov.push_back({frame.data, pager->page_size});
+        if (!is_write) {
+            frame.io_request = request;
+        }
+        request->length += pager->page_size;
+        previous_page_num = frame.page_num;
     }
+    metrics_increment(METRIC_IO_REQUESTS, batch.size());
+    io_submit(pager->io, batch.data(), batch.size());
+    pager->io_requests.insert(pager->io_requests.end(), batch.begin(), batch.end());
+}
 
-    ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
+// Waits for every outstanding batched request and accounts for it.
+void pager_complete_io(Pager* pager) {
+    pager_retire_io(pager, true);
+}
 
-    if (bytes_written == -1) {
-        std::cerr << "Error writing to file: " << strerror(errno) << std::endl;
+// Blocks until the read into one prefetched frame has landed.
+static void pager_wait_frame(Pager* pager, uint32_t frame_index) {
+    IoRequest* request = pager->frames[frame_index].io_request;
+    io_wait(pager->io, request);
+    if (request->result < 0 || (uint64_t)request->result != request->length) {
+        std::cerr << "Error reading file: " << strerror(request->result < 0 ? -request->result : EIO) << std::endl;
         exit(EXIT_FAILURE);
     }
+    pager_finish_read(pager, frame_index);
+}
+
+// Called once the read into a frame has landed. A compressed page arrives
+// in the frame's own buffer and is expanded there.
+static void pager_finish_read(Pager* pager, uint32_t frame_index) {
+    Frame& frame = pager->frames[frame_index];
+    if (pager->compressed) {
+        decompress_page(pager, frame.page_num, (char*)frame.data, frame.io_request->length);
+    }
+    frame.io_request = nullptr;
 }
 
+// Accounts for and frees finished requests, unlinking them from the frames
+// they filled. With `wait` it first waits for everything in flight.
+static void pager_retire_io(Pager* pager, bool wait) {
+    if (pager->io_requests.empty()) {
+        return;
+    }
+    if (wait) {
+        io_wait_all(pager->io);
+    } else {
+        io_poll(pager->io);
+    }
+    size_t kept = 0;
+    for (IoRequest* request : pager->io_requests) {
+        if (!request->completed) {
+            pager->io_requests[kept++] = request;
+            continue;
+        }
+        if (request->result < 0 || (uint64_t)request->result != request->length) {
+            std::cerr << "Error " << (request->is_write ? "writing to" : "reading") << " file: "
+                      << strerror(request->result < 0 ? -request->result : EIO) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        uint32_t first_page_num = request->user_data;
+        for (uint32_t i = 0; i < request->iov.size(); i++) {
+            auto found = pager->page_table.find(first_page_num + i);
+            if (found != pager->page_table.end() && pager->frames[found->second].io_request == request) {
+                pager_finish_read(pager, found->second);
+            }
+        }
+        if (request->is_write) {
+            uint64_t end_page_num = first_page_num + request->iov.size();
+            pager->file_length = std::max<uint64_t>(pager->file_length, end_page_num * pager->page_size);
+            metrics_increment(METRIC_PAGES_WRITTEN, request->iov.size());
+            metrics_increment(METRIC_BYTES_WRITTEN, request->length);
+        } else {
+            metrics_increment(METRIC_PAGES_READ, request->iov.size());
+            metrics_increment(METRIC_BYTES_READ, request->length);
+        }
+        delete request;
+    }
+    pager->io_requests.resize(kept);
+}
+
+// Cached pages, most used first. Prefetched pages nobody has asked for
+// yet come last rather than being dropped, so a short session after a
+// warm-up keeps the list it started from. The header page is left out
+// since opening the file reads it anyway, and so are free pages, trunks
+// included: a freed node keeps its old contents but nothing reads it.
+// Empty for the mmap backend, which leaves caching to the kernel.
+void pager_hot_pages(Pager* pager, std::vector<uint32_t>* page_nums) {
+    std::vector<uint32_t> frame_indices;
+    for (uint32_t i = 0; i < pager->frames.size(); i++) {
+        if (pager->frames[i].page_num != DB_HEADER_PAGE_NUM && !pager->frames[i].is_free) {
+            frame_indices.push_back(i);
+        }
+    }
+    std::stable_sort(frame_indices.begin(), frame_indices.end(), [pager](uint32_t a, uint32_t b) {
+        return pager->frames[a].uses > pager->frames[b].uses;
+    });
+    page_nums->clear();
+    for (uint32_t frame_index : frame_indices) {
+        page_nums->push_back(pager->frames[frame_index].page_num);
+    }
+}
+
+// Replaces the warm-up list with `page_nums` (at most one pool's worth).
+// The list is only a hint, so failing to write it is reported and ignored.
+void pager_save_warm_list(Pager* pager, const std::vector<uint32_t>& page_nums) {
+    WarmListHeader header = {};
+    memcpy(header.magic, WARM_LIST_MAGIC, sizeof(WARM_LIST_MAGIC));
+    header.page_size = pager->page_size;
+    header.num_pages = std::min<uint32_t>(page_nums.size(), pager->capacity);
+    std::string contents((const char*)&header, sizeof(header));
+    contents.append((const char*)page_nums.data(), header.num_pages * sizeof(uint32_t));
+
+    // Written aside and renamed over the old list, so a crash never leaves
+    // a torn one behind.
+    std::string temporary_path = pager->warm_list_path + ".tmp";
+    int fd = open(temporary_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        std::cerr << "Unable to save warm-up list '" << temporary_path << "': " << strerror(errno) << std::endl;
+        return;
+    }
+    size_t written = 0;
+    while (written < contents.size()) {
+        ssize_t result = write(fd, contents.data() + written, contents.size() - written);
+        if (result == -1 && errno == EINTR) {
+            continue;
+        }
+        if (result == -1) {
+            std::cerr << "Error writing warm-up list: " << strerror(errno) << std::endl;
+            close(fd);
+            unlink(temporary_path.c_str());
+            return;
+        }
+        written += result;
+    }
+    close(fd);
+    if (rename(temporary_path.c_str(), pager->warm_list_path.c_str()) == -1) {
+        std::cerr << "Unable to save warm-up list '" << pager->warm_list_path << "': " << strerror(errno) << std::endl;
+        unlink(temporary_path.c_str());
+    }
+}
+
+// Starts reading the pages named in the warm-up list, if there is one, and
+// returns without waiting for them. Lists from another page size are
+// ignored and stale page numbers are skipped by pager_prefetch.
+void pager_warm_up(Pager* pager) {
+    int fd = open(pager->warm_list_path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return;
+    }
+    WarmListHeader header = {};
+    std::vector<uint32_t> page_nums;
+    if (read(fd, &header, sizeof(header)) == (ssize_t)sizeof(header) &&
+        memcmp(header.magic, WARM_LIST_MAGIC, sizeof(WARM_LIST_MAGIC)) == 0 &&
+        header.page_size == pager->page_size) {
+        page_nums.resize(std::min(header.num_pages, pager->capacity));
+        ssize_t length = read(fd, page_nums.data(), page_nums.size() * sizeof(uint32_t));
+        page_nums.resize(length > 0 ? length / sizeof(uint32_t) : 0);
+    }
+    close(fd);
+    pager_prefetch(pager, page_nums.data(), page_nums.size());
+}
+
+// Takes a page off the free list if there is one, else the page past the
+// end of the file. The caller must fetch the page with get_page and
+// initialize it before asking for another.
 uint32_t get_unused_page_num(Pager* pager) {
-    return pager->num_pages;
+    if (pager->is_legacy_format ||
+        ((DatabaseHeader*)get_page_for_read(pager, DB_HEADER_PAGE_NUM))->free_list_trunk == 0) {
+        return pager->num_pages;
+    }
+    explain_free_list(pager->trace, true);
+    uint32_t page_num = free_list_pop(pager);
+    pager_mark_free(pager, page_num, false);
+    explain_free_list(pager->trace, false);
+    explain_page_freed(pager->trace, page_num, false);
+    return page_num;
+}
+
+static uint32_t free_list_pop(Pager* pager) {
+    DatabaseHeader* header = (DatabaseHeader*)get_page(pager, DB_HEADER_PAGE_NUM);
+    uint32_t trunk_page_num = header->free_list_trunk;
+    uint32_t* trunk = (uint32_t*)free_list_page(pager, trunk_page_num);
+    header->free_page_count--;
+    metrics_gauge_add(METRIC_GAUGE_FREE_PAGES, -1);
+    if (trunk[FREE_TRUNK_COUNT_INDEX] > 0) {
+        return trunk[FREE_TRUNK_HEADER_WORDS + --trunk[FREE_TRUNK_COUNT_INDEX]];
+    }
+    // An empty trunk is handed out itself.
+    header->free_list_trunk = trunk[FREE_TRUNK_NEXT_INDEX];
+    return trunk_page_num;
+}
+
+// Lists `page_num` as free. It must no longer be reachable from the tree;
+// its contents are left as they are unless it becomes a trunk.
+void pager_free_page(Pager* pager, uint32_t page_num) {
+    explain_free_list(pager->trace, true);
+    DatabaseHeader* header = (DatabaseHeader*)get_page(pager, DB_HEADER_PAGE_NUM);
+    uint32_t trunk_capacity = pager->page_size / sizeof(uint32_t) - FREE_TRUNK_HEADER_WORDS;
+    uint32_t* trunk = header->free_list_trunk == 0 ? nullptr : (uint32_t*)free_list_page(pager, header->free_list_trunk);
+    if (trunk != nullptr && trunk[FREE_TRUNK_COUNT_INDEX] < trunk_capacity) {
+        trunk[FREE_TRUNK_HEADER_WORDS + trunk[FREE_TRUNK_COUNT_INDEX]++] = page_num;
+    } else {
+        trunk = (uint32_t*)free_list_page(pager, page_num);
+        trunk[FREE_TRUNK_NEXT_INDEX] = header->free_list_trunk;
+        trunk[FREE_TRUNK_COUNT_INDEX] = 0;
+        header->free_list_trunk = page_num;
+    }
+    pager_mark_free(pager, page_num, true);
+    header->free_page_count++;
+    metrics_increment(METRIC_PAGES_FREED);
+    metrics_gauge_add(METRIC_GAUGE_FREE_PAGES, 1);
+    explain_free_list(pager->trace, false);
+    explain_page_freed(pager->trace, page_num, true);
+}
+
+// Fetches a trunk page for writing. Trunks are free pages themselves, and
+// one left over from an earlier session is only ever read here.
+static void* free_list_page(Pager* pager, uint32_t page_num) {
+    void* page = get_page(pager, page_num);
+    pager_mark_free(pager, page_num, true);
+    return page;
+}
+
+// Records whether a cached page is on the free list. Pages that are not in
+// the pool are not read when they are freed, so there is nothing to mark.
+static void pager_mark_free(Pager* pager, uint32_t page_num, bool is_free) {
+    auto found = pager->page_table.find(page_num);
+    if (found != pager->page_table.end()) {
+        pager->frames[found->second].is_free = is_free;
+    }
+}
+
+uint32_t pager_free_page_count(Pager* pager) {
+    return ((DatabaseHeader*)get_page_for_read(pager, DB_HEADER_PAGE_NUM))->free_page_count;
+}
+
+void pager_initialize_header(Pager* pager) {
+    DatabaseHeader* header = (DatabaseHeader*)get_page(pager, DB_HEADER_PAGE_NUM);
+    memset(header, 0, pager->page_size);
+    memcpy(header->magic, DB_FILE_MAGIC, sizeof(DB_FILE_MAGIC));
+    header->format_version = pager->format_version;
+    header->page_size = pager->page_size;
+    header->root_page_num = 0;
+    header->flags = pager->compressed ? DB_FLAG_COMPRESSED : 0;
+    pager->is_legacy_format = false;
+}
+
+uint32_t pager_root_page_num(Pager* pager) {
+    return ((DatabaseHeader*)get_page_for_read(pager, DB_HEADER_PAGE_NUM))->root_page_num;
+}
+
+void pager_set_root_page_num(Pager* pager, uint32_t root_page_num) {
+    ((DatabaseHeader*)get_page(pager, DB_HEADER_PAGE_NUM))->root_page_num = root_page_num;
+}
+
+void pager_set_format_version(Pager* pager, uint32_t format_version) {
+    ((DatabaseHeader*)get_page(pager, DB_HEADER_PAGE_NUM))->format_version = format_version;
+    pager->format_version = format_version;
+}
+
+// --- Compressed Storage ---
+static uint32_t extent_sectors(uint64_t length) {
+    return (length + COMPRESSED_SECTOR_SIZE - 1) / COMPRESSED_SECTOR_SIZE;
+}
+
+// Reads the page map named by the header and rebuilds the free extents
+// from the gaps between the extents in use.
+static void map_load(Pager* pager, const DatabaseHeader& header) {
+    pager->free_extents.assign(pager->page_size / COMPRESSED_SECTOR_SIZE + 1, std::vector<uint64_t>());
+    pager->compress_buffer.resize(pager->page_size);
+    pager->extents_end = pager->page_size;
+    pager->map_offset = header.map_offset;
+    pager->map_length = header.map_length;
+    pager->map_dirty = false;
+    if (pager->file_length == 0) {
+        return;
+    }
+
+    if (pager->map_length % sizeof(PageExtent) != 0) {
+        std::cerr << "Page map has an invalid length. Corrupt file." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    pager->extents.resize(pager->map_length / sizeof(PageExtent));
+    if (read_fully(pager, pager->extents.data(), pager->map_length, pager->map_offset) != pager->map_length) {
+        std::cerr << "Page map lies past the end of the file. Corrupt file." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    pager->num_pages = std::max<uint32_t>(1, pager->extents.size());
+    pager->file_length = (uint64_t)pager->num_pages * pager->page_size;
+
+    std::vector<std::pair<uint64_t, uint64_t>> used; // start and end of each extent
+    for (const PageExtent& extent : pager->extents) {
+        if (extent.offset == 0) {
+            continue;
+        }
+        if (extent.length == 0 || extent.length > pager->page_size || extent.offset < pager->page_size) {
+            std::cerr << "Page map has an invalid extent. Corrupt file." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        used.push_back({extent.offset, extent.offset + (uint64_t)extent_sectors(extent.length) * COMPRESSED_SECTOR_SIZE});
+    }
+    if (pager->map_length > 0) {
+        used.push_back({pager->map_offset, pager->map_offset + extent_sectors(pager->map_length) * COMPRESSED_SECTOR_SIZE});
+    }
+    std::sort(used.begin(), used.end());
+    for (const auto& range : used) {
+        if (range.first > pager->extents_end) {
+            extent_free_range(pager, pager->extents_end, range.first - pager->extents_end);
+        }
+        pager->extents_end = std::max(pager->extents_end, range.second);
+    }
+}
+
+// Writes the page map to a fresh extent and points the header at it. The
+// previous map's extent is only freed now, so the header on disk keeps
+// naming an intact map until the new header is written.
+static void map_save(Pager* pager) {
+    DatabaseHeader* header = (DatabaseHeader*)get_page(pager, DB_HEADER_PAGE_NUM);
+    pager->extents.resize(std::max<size_t>(pager->extents.size(), pager->num_pages));
+    uint64_t length = pager->extents.size() * sizeof(PageExtent);
+    uint64_t offset = pager->extents_end;
+    pager->extents_end += extent_sectors(length) * COMPRESSED_SECTOR_SIZE;
+    write_fully(pager, pager->extents.data(), length, offset);
+    metrics_increment(METRIC_BYTES_WRITTEN, length);
+
+    if (pager->map_length > 0) {
+        extent_free_range(pager, pager->map_offset, extent_sectors(pager->map_length) * COMPRESSED_SECTOR_SIZE);
+    }
+    pager->map_offset = offset;
+    pager->map_length = length;
+    pager->map_dirty = false;
+    header->flags |= DB_FLAG_COMPRESSED;
+    header->map_offset = offset;
+    header->map_length = length;
+}
+
+// Returns the bytes to store for `page`: its compressed form, built in
+// `buffer`, or the page itself when compressing would not save a sector.
+static const char* compress_page(Pager* pager, const void* page, char* buffer, uint32_t* length) {
+    uint32_t compressed_length = lz_compress((const char*)page, pager->page_size, buffer,
+                                             pager->page_size - COMPRESSED_SECTOR_SIZE);
+    if (compressed_length == 0) {
+        *length = pager->page_size;
+        return (const char*)page;
+    }
+    *length = compressed_length;
+    return buffer;
+}
+
+// Expands the `length` stored bytes at the start of `page` in place.
+static void decompress_page(Pager* pager, uint32_t page_num, char* page, uint32_t length) {
+    if (length == pager->page_size) {
+        return;
+    }
+    memcpy(pager->compress_buffer.data(), page, length);
+    if (!lz_decompress(pager->compress_buffer.data(), length, page, pager->page_size)) {
+        std::cerr << "Compressed page " << page_num << " does not decode. Corrupt file." << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Finds room for a page's new contents and returns its file offset. A page
+// that still fits its extent is rewritten in place, giving back any sectors
+// it no longer needs.
+static uint64_t extent_assign(Pager* pager, uint32_t page_num, uint32_t length) {
+    if (page_num >= pager->extents.size()) {
+        pager->extents.resize(page_num + 1, PageExtent{});
+    }
+    PageExtent& extent = pager->extents[page_num];
+    uint32_t sectors = extent_sectors(length);
+    pager->map_dirty = true;
+    if (extent.offset != 0) {
+        uint32_t old_sectors = extent_sectors(extent.length);
+        if (sectors <= old_sectors) {
+            extent_free_range(pager, extent.offset + (uint64_t)sectors * COMPRESSED_SECTOR_SIZE,
+                              (uint64_t)(old_sectors - sectors) * COMPRESSED_SECTOR_SIZE);
+            extent.length = length;
+            return extent.offset;
+        }
+        pager->free_extents[old_sectors].push_back(extent.offset);
+    }
+    extent.offset = extent_allocate(pager, sectors);
+    extent.length = length;
+    return extent.offset;
+}
+
+// Takes the smallest free extent that fits, splitting off the rest, or
+// grows the file.
+static uint64_t extent_allocate(Pager* pager, uint32_t sectors) {
+    for (uint32_t size = sectors; size < pager->free_extents.size(); size++) {
+        if (!pager->free_extents[size].empty()) {
+            uint64_t offset = pager->free_extents[size].back();
+            pager->free_extents[size].pop_back();
+            extent_free_range(pager, offset + (uint64_t)sectors * COMPRESSED_SECTOR_SIZE,
+                              (uint64_t)(size - sectors) * COMPRESSED_SECTOR_SIZE);
+            return offset;
+        }
+    }
+    uint64_t offset = pager->extents_end;
+    pager->extents_end += (uint64_t)sectors * COMPRESSED_SECTOR_SIZE;
+    return offset;
+}
+
+// Returns a range of whole sectors to the free lists, in extents of at most
+// one page.
+static void extent_free_range(Pager* pager, uint64_t offset, uint64_t length) {
+    uint32_t max_sectors = pager->free_extents.size() - 1;
+    while (length >= COMPRESSED_SECTOR_SIZE) {
+        uint32_t sectors = std::min<uint64_t>(max_sectors, length / COMPRESSED_SECTOR_SIZE);
+        pager->free_extents[sectors].push_back(offset);
+        offset += (uint64_t)sectors * COMPRESSED_SECTOR_SIZE;
+        length -= (uint64_t)sectors * COMPRESSED_SECTOR_SIZE;
+    }
 }
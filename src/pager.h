@@ -2,18 +2,240 @@
 #define PAGER_H
 
 #include "common.h"
+#include "io.h"
 #include <sys/stat.h>
+#include <unordered_map>
+
+struct ExplainTrace;
+
+// --- File Header ---
+// Page 0 of every database file holds this header; the B-tree lives in the
+// pages after it. Files written before the header existed (root at page 0)
+// are detected by the missing magic and upgraded on open, as are files of
+// an older format version.
+const char DB_FILE_MAGIC[8] = {'t', 'o', 'y', 'd', 'b', '\0', '\0', '\0'};
+// Version 7 packs internal nodes' keys as well; version 6 packed only each
+// row leaf's keys against a per-leaf base; version 5 kept those whole too,
+// and was the first with a structured record per table in the catalog;
+// version 4 rooted the file at a catalog too, but described each table as
+// text in a users row; version 3 held a single table and linked leaves to
+// their left sibling as well; version 2 stored leaf keys apart from the
+// values but linked leaves forward only; version 1 leaves interleaved keys
+// and values in cells.
+const uint32_t DB_FORMAT_VERSION = 7;
+const uint32_t DB_FORMAT_VERSION_UNPACKED_INTERNAL_KEYS = 6;
+const uint32_t DB_FORMAT_VERSION_UNPACKED_KEYS = 5;
+const uint32_t DB_FORMAT_VERSION_TEXT_CATALOG = 4;
+const uint32_t DB_FORMAT_VERSION_SINGLE_TABLE = 3;
+const uint32_t DB_FORMAT_VERSION_FORWARD_LINKED_LEAVES = 2;
+const uint32_t DB_FORMAT_VERSION_INTERLEAVED_LEAVES = 1;
+const uint32_t DB_HEADER_PAGE_NUM = 0;
+
+struct DatabaseHeader {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t page_size;
+    uint32_t root_page_num; // the catalog's; before version 4, the only table's
+    uint32_t flags;
+    // Compressed files: where the page map was last saved.
+    uint64_t map_offset;
+    uint64_t map_length;
+    // First trunk page of the free list (0 = none) and the pages it holds,
+    // trunks included.
+    uint32_t free_list_trunk;
+    uint32_t free_page_count;
+};
+
+// --- Free Page List ---
+// Pages the tree lets go of are listed for reuse. The list is a chain of
+// trunk pages, themselves free pages, each holding the next trunk's number,
+// a count and an array of free page numbers. Freeing a page appends its
+// number to the first trunk without touching the page, so a whole subtree
+// is released without reading its leaves; allocation takes listed pages
+// before it grows the file. Files without the fields read them as zero, an
+// empty list.
+const uint32_t FREE_TRUNK_NEXT_INDEX = 0;
+const uint32_t FREE_TRUNK_COUNT_INDEX = 1;
+const uint32_t FREE_TRUNK_HEADER_WORDS = 2;
+
+// --- Compressed Storage ---
+// Optional, chosen when a database is created. The header page stays raw
+// at the start of the file; every other page is compressed (see
+// compress.h) into an extent, a run of COMPRESSED_SECTOR_SIZE-byte sectors
+// anywhere after it. A page map from page number to extent lives in memory
+// and is written to a fresh extent at every checkpoint, its location kept
+// in the header. Freed extents are reused by size.
+const uint32_t DB_FLAG_COMPRESSED = 1;
+const uint32_t COMPRESSED_SECTOR_SIZE = 512;
+
+struct PageExtent {
+    uint64_t offset; // 0 = the page has never been written
+    uint32_t length; // compressed bytes, or the page size if stored raw
+    uint32_t reserved;
+};
+
+// --- Warm-Up List ---
+// The page numbers of the hot set are saved next to the database file at
+// checkpoint and close, and prefetched in the background when it is opened
+// again, so a restarted process does not start from a cold buffer pool.
+const char WARM_LIST_MAGIC[8] = {'t', 'o', 'y', 'w', 'a', 'r', 'm', '\0'};
+const char* const WARM_LIST_SUFFIX = "-warm";
+
+struct WarmListHeader {
+    char magic[8];
+    uint32_t page_size;
+    uint32_t num_pages; // page numbers that follow, hottest first
+};
+
+// --- Pager Options ---
+const uint32_t PAGER_DEFAULT_READAHEAD_WINDOW = 32;
+
+// The buffered backend caches copies of pages in its own frames; the mmap
+// backend maps the file and hands out pointers into the mapping, leaving
+// caching and write-back to the kernel page cache.
+enum PagerBackend { PAGER_BACKEND_BUFFERED, PAGER_BACKEND_MMAP };
+
+struct PagerOptions {
+    uint32_t page_size = DEFAULT_PAGE_SIZE; // only used when creating a file
+    bool compress = false;                  // only used when creating a file
+    PagerBackend backend = PAGER_BACKEND_BUFFERED;
+    IoBackend io_backend = IO_BACKEND_AUTO;
+    // Bypass the kernel page cache (O_DIRECT) so the buffer pool is the
+    // only cache; buffered backend only.
+    bool direct_io = false;
+    // Back the buffer pool arena with huge pages when the system has them.
+    bool huge_pages = false;
+    // Leaves a scanning cursor keeps prefetched ahead of itself; 0 disables
+    // read-ahead.
+    uint32_t readahead_window = PAGER_DEFAULT_READAHEAD_WINDOW;
+};
+
+// Access-pattern hint passed to madvise by the mmap backend.
+enum PagerAccessPattern { ACCESS_NORMAL, ACCESS_RANDOM, ACCESS_SEQUENTIAL };
+
+// The mmap backend reserves this much address space up front and maps the
+// file into it chunk by chunk, so page pointers never move as it grows.
+const uint64_t PAGER_MMAP_RESERVE_BYTES = 1ULL << 40;
+const uint64_t PAGER_MMAP_CHUNK_BYTES = 64ULL << 20;
+
+// Frame buffers are aligned for O_DIRECT, which needs the buffer, offset
+// and length aligned to the device's logical block size.
+const uint32_t PAGER_BUFFER_ALIGNMENT = 4096;
+const uint64_t PAGER_HUGE_PAGE_SIZE = 2ULL << 20;
+
+// Batched I/O merges runs of adjacent pages into one request of at most
+// this many pages.
+const uint32_t PAGER_IO_MAX_COALESCE = 32;
+
+// --- Buffer Pool ---
+// Pages are cached in frames and replaced in LRU order. A pointer returned
+// by get_page stays valid until the next pager_begin_operation: frames
+// touched since then are never evicted (the pool grows past its capacity
+// instead), so code may hold several page pointers within one operation.
+const uint32_t NO_FRAME = UINT32_MAX;
+
+struct Frame {
+    uint32_t page_num;
+    void* data;
+    bool dirty;
+    IoRequest* io_request; // batched read into `data` that may not have completed
+    uint32_t uses;         // fetches since the page was loaded
+    bool is_free;          // on the free list, so left out of the warm-up list
+    uint64_t epoch;
+    uint32_t lru_prev;
+    uint32_t lru_next;
+
+    // Swizzled child pointers (internal nodes only): the frame holding the
+    // child at each index, or NO_FRAME. An entry is trusted only while that
+    // frame still holds the page the node names at that index, so node
+    // edits never leave a wrong pointer behind. `swizzled_by` and
+    // `swizzled_index` locate the one parent entry pointing at this frame,
+    // which is cleared when the frame is evicted.
+    std::vector<uint32_t> children;
+    uint32_t swizzled_by;
+    uint32_t swizzled_index;
+};
 
 struct Pager {
     int file_descriptor;
-    uint32_t file_length;
+    uint32_t page_size;
+    PagerBackend backend;
+    uint64_t file_length;
     uint32_t num_pages;
-    void* pages[TABLE_MAX_PAGES];
+    // The file predates the header page and must be upgraded by the caller.
+    bool is_legacy_format;
+    // Format version recorded in the header; older versions are upgraded
+    // by the caller.
+    uint32_t format_version;
+
+    uint32_t capacity;
+    std::vector<Frame> frames;
+    std::unordered_map<uint32_t, uint32_t> page_table;
+    uint32_t lru_head; // most recently used
+    uint32_t lru_tail; // eviction candidate
+    uint64_t epoch;
+
+    // Frame buffers are carved from one arena sized for `capacity` frames.
+    char* arena;
+    uint64_t arena_size;
+    uint64_t arena_used;
+    bool direct_io;
+    uint32_t readahead_window;
+    std::string warm_list_path;
+
+    // Batched reads and writes; requests stay here until they complete.
+    IoQueue* io;
+    std::vector<IoRequest*> io_requests;
+
+    // Compressed storage: the extent of every page, free extents indexed by
+    // their size in sectors, the end of the last extent and the extent
+    // holding the saved map, which is freed once a newer map is saved. With
+    // compression file_length counts logical pages, not file bytes.
+    bool compressed;
+    std::vector<PageExtent> extents;
+    std::vector<std::vector<uint64_t>> free_extents;
+    uint64_t extents_end;
+    uint64_t map_offset;
+    uint64_t map_length;
+    bool map_dirty; // extents changed since the map was last saved
+    std::vector<char> compress_buffer;
+    std::vector<char> compress_staging; // compressed pages of a batched write
+
+    // mmap backend: the reserved range, of which the first file_length
+    // bytes map the file.
+    char* map_base;
+    PagerAccessPattern access_pattern;
+
+    // Set while an "explain analyze" statement runs; null otherwise.
+    ExplainTrace* trace;
 };
 
-Pager* pager_open(const std::string& filename);
+bool pager_valid_page_size(uint32_t page_size);
+bool parse_pager_backend(const std::string& name, PagerBackend* backend);
+Pager* pager_open(const std::string& filename, const PagerOptions& options);
+void pager_close(Pager* pager);
+void pager_begin_operation(Pager* pager);
 void* get_page(Pager* pager, uint32_t page_num);
+void* get_page_for_read(Pager* pager, uint32_t page_num);
+void* pager_cached_page(Pager* pager, uint32_t page_num);
+void* pager_descend_root(Pager* pager, uint32_t page_num, uint32_t* frame_index);
+void* pager_descend(Pager* pager, uint32_t* frame_index, uint32_t child_index, uint32_t child_page_num);
 void pager_flush(Pager* pager, uint32_t page_num);
+void pager_flush_all(Pager* pager);
+void pager_prefetch(Pager* pager, const uint32_t* page_nums, uint32_t num_pages);
+void pager_complete_io(Pager* pager);
 uint32_t get_unused_page_num(Pager* pager);
+void pager_free_page(Pager* pager, uint32_t page_num);
+uint32_t pager_free_page_count(Pager* pager);
+void pager_advise(Pager* pager, PagerAccessPattern pattern);
+
+void pager_hot_pages(Pager* pager, std::vector<uint32_t>* page_nums);
+void pager_save_warm_list(Pager* pager, const std::vector<uint32_t>& page_nums);
+void pager_warm_up(Pager* pager);
+
+void pager_initialize_header(Pager* pager);
+uint32_t pager_root_page_num(Pager* pager);
+void pager_set_root_page_num(Pager* pager, uint32_t root_page_num);
+void pager_set_format_version(Pager* pager, uint32_t format_version);
 
-#endif // PAGER_H
\ No newline at end of file
+#endif // PAGER_H
@@ -2,6 +2,8 @@
 #define ROW_H
 
 #include "common.h"
+#include "schema.h"
+#include <string_view>
 
 // Define fixed-size constants for our table schema.
 #define COLUMN_USERNAME_SIZE 32
@@ -15,29 +17,60 @@ struct Row {
 };
 
 // --- Serialization & Deserialization ---
-const uint32_t ID_SIZE = sizeof(uint32_t);
-const uint32_t USERNAME_SIZE = sizeof(char) * (COLUMN_USERNAME_SIZE + 1);
-const uint32_t EMAIL_SIZE = sizeof(char) * (COLUMN_EMAIL_SIZE + 1);
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+// The users row layout, which every table's rows use. Its codec is
+// generated from the schema; the sizes and offsets below are the file
+// format and must not change.
+using UsersSchema = Schema<Col<uint32_t>, Col<VarChar<COLUMN_USERNAME_SIZE>>, Col<VarChar<COLUMN_EMAIL_SIZE>>>;
+enum UsersColumn { USERS_COLUMN_ID, USERS_COLUMN_USERNAME, USERS_COLUMN_EMAIL };
 
-const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
+const uint32_t ID_SIZE = UsersSchema::sizes[USERS_COLUMN_ID];
+const uint32_t USERNAME_SIZE = UsersSchema::sizes[USERS_COLUMN_USERNAME];
+const uint32_t EMAIL_SIZE = UsersSchema::sizes[USERS_COLUMN_EMAIL];
+const uint32_t ROW_SIZE = UsersSchema::row_size;
+
+const uint32_t ID_OFFSET = UsersSchema::offsets[USERS_COLUMN_ID];
+const uint32_t USERNAME_OFFSET = UsersSchema::offsets[USERS_COLUMN_USERNAME];
+const uint32_t EMAIL_OFFSET = UsersSchema::offsets[USERS_COLUMN_EMAIL];
+static_assert(ROW_SIZE == 293 && USERNAME_OFFSET == 4 && EMAIL_OFFSET == 37, "users rows are 4 + 33 + 256 bytes on disk");
 
 // Convert a Row struct to a compact binary representation.
 inline void serialize_row(const Row* source, void* destination) {
-    memcpy((char*)destination + ID_OFFSET, &(source->id), ID_SIZE);
-    strncpy((char*)destination + USERNAME_OFFSET, source->username, COLUMN_USERNAME_SIZE);
-    strncpy((char*)destination + EMAIL_OFFSET, source->email, COLUMN_EMAIL_SIZE);
+    UsersSchema::serialize((char*)destination, source->id, source->username, source->email);
 }
 
 // Convert a compact binary representation back to a Row struct.
 inline void deserialize_row(const void* source, Row* destination) {
-    memcpy(&(destination->id), (char*)source + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), (char*)source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), (char*)source + EMAIL_OFFSET, EMAIL_SIZE);
-    destination->username[COLUMN_USERNAME_SIZE] = '\0';
-    destination->email[COLUMN_EMAIL_SIZE] = '\0';
+    UsersSchema::deserialize((const char*)source, &(destination->id), destination->username, destination->email);
+}
+
+// A read-only, zero-copy view of a stored row, one pointer per column slot,
+// so it works whether a row's columns are kept together or apart. It points
+// straight into a cached page, so it is only valid until the pager reuses
+// that page's memory. Each accessor reads only its own column.
+struct RowView {
+    const char* columns[UsersSchema::num_columns];
+
+    uint32_t id() const {
+        return UsersSchema::Column<USERS_COLUMN_ID>::read(columns[USERS_COLUMN_ID]);
+    }
+    std::string_view username() const {
+        return UsersSchema::Column<USERS_COLUMN_USERNAME>::read(columns[USERS_COLUMN_USERNAME]);
+    }
+    std::string_view email() const {
+        return UsersSchema::Column<USERS_COLUMN_EMAIL>::read(columns[USERS_COLUMN_EMAIL]);
+    }
+    void read(Row* row) const {
+        UsersSchema::gather(columns, &(row->id), row->username, row->email);
+    }
+};
+
+// A view of a row serialized into one buffer.
+inline RowView row_view(const char* row) {
+    RowView view;
+    for (uint32_t column = 0; column < UsersSchema::num_columns; column++) {
+        view.columns[column] = row + UsersSchema::offsets[column];
+    }
+    return view;
 }
 
-#endif // ROW_H
\ No newline at end of file
+#endif // ROW_H
@@ -0,0 +1,155 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include "common.h"
+#include <array>
+#include <string_view>
+#include <tuple>
+#include <utility>
+
+// --- Compile-Time Row Schemas ---
+// A schema is a list of column types, Schema<Col<uint32_t>, Col<VarChar<32>>>.
+// A row is the columns' fixed-size slots back to back. The compiler works out
+// each slot's offset and the row size as constants, and expands the codec
+// below into straight-line code for that one layout, the same code one
+// would write by hand, with nothing interpreted per field at run time.
+// Two schemas are defined: UsersSchema (row.h), the rows of every table,
+// and CatalogSchema (table.h), the catalog's records. Tables do not have
+// column lists of their own yet, so a schema is a build-time layout, not
+// something a table is created with.
+
+// A string of up to N bytes, kept in an N + 1 byte slot padded with NULs.
+template <uint32_t N>
+struct VarChar {};
+
+// Column codecs: the slot size and how a value is written, read and ordered.
+template <typename T>
+struct Col;
+
+template <>
+struct Col<uint32_t> {
+    using Value = uint32_t;
+    static constexpr uint32_t size = sizeof(uint32_t);
+
+    static void write(char* slot, uint32_t value) {
+        memcpy(slot, &value, size);
+    }
+    static uint32_t read(const char* slot) {
+        uint32_t value;
+        memcpy(&value, slot, size);
+        return value;
+    }
+    static void read_into(const char* slot, uint32_t* value) {
+        *value = read(slot);
+    }
+    static int compare(const char* a, const char* b) {
+        uint32_t left = read(a), right = read(b);
+        return (left > right) - (left < right);
+    }
+};
+
+template <uint32_t N>
+struct Col<VarChar<N>> {
+    using Value = std::string_view;
+    static constexpr uint32_t size = N + 1;
+
+    // Keeps at most N bytes of the NUL-terminated `value`.
+    static void write(char* slot, const char* value) {
+        size_t length = strnlen(value, N);
+        memcpy(slot, value, length);
+        memset(slot + length, 0, size - length);
+    }
+    static std::string_view read(const char* slot) {
+        return std::string_view(slot, strnlen(slot, N));
+    }
+    // `value` is a char[N + 1], and comes back NUL-terminated.
+    static void read_into(const char* slot, char* value) {
+        memcpy(value, slot, N);
+        value[N] = '\0';
+    }
+    static int compare(const char* a, const char* b) {
+        return read(a).compare(read(b));
+    }
+};
+
+template <size_t N>
+constexpr std::array<uint32_t, N> schema_offsets(const std::array<uint32_t, N>& sizes) {
+    std::array<uint32_t, N> offsets{};
+    uint32_t offset = 0;
+    for (size_t i = 0; i < N; i++) {
+        offsets[i] = offset;
+        offset += sizes[i];
+    }
+    return offsets;
+}
+
+template <typename... Columns>
+struct Schema {
+    static constexpr uint32_t num_columns = sizeof...(Columns);
+    static constexpr std::array<uint32_t, num_columns> sizes = {Columns::size...};
+    static constexpr std::array<uint32_t, num_columns> offsets = schema_offsets(sizes);
+    static constexpr uint32_t row_size = (Columns::size + ... + 0);
+
+    template <uint32_t I>
+    using Column = std::tuple_element_t<I, std::tuple<Columns...>>;
+
+    // Projection: one column is read or written without touching the rest.
+    template <uint32_t I>
+    static typename Column<I>::Value get(const char* row) {
+        return Column<I>::read(row + offsets[I]);
+    }
+    template <uint32_t I, typename Value>
+    static void set(char* row, const Value& value) {
+        Column<I>::write(row + offsets[I], value);
+    }
+    // Orders two rows by one column: negative, zero or positive.
+    template <uint32_t I>
+    static int compare(const char* a, const char* b) {
+        return Column<I>::compare(a + offsets[I], b + offsets[I]);
+    }
+
+    // One value per column, in order.
+    template <typename... Values>
+    static void serialize(char* row, const Values&... values) {
+        static_assert(sizeof...(Values) == num_columns, "serialize takes one value per column");
+        serialize_columns(row, std::make_index_sequence<num_columns>(), values...);
+    }
+    // One output pointer per column, in order.
+    template <typename... Outputs>
+    static void deserialize(const char* row, Outputs*... outputs) {
+        static_assert(sizeof...(Outputs) == num_columns, "deserialize takes one output per column");
+        deserialize_columns(row, std::make_index_sequence<num_columns>(), outputs...);
+    }
+    // The same codecs for a row whose columns are stored apart, given one
+    // slot pointer per column.
+    template <typename... Values>
+    static void scatter(char* const* slots, const Values&... values) {
+        static_assert(sizeof...(Values) == num_columns, "scatter takes one value per column");
+        scatter_columns(slots, std::make_index_sequence<num_columns>(), values...);
+    }
+    template <typename... Outputs>
+    static void gather(const char* const* slots, Outputs*... outputs) {
+        static_assert(sizeof...(Outputs) == num_columns, "gather takes one output per column");
+        gather_columns(slots, std::make_index_sequence<num_columns>(), outputs...);
+    }
+
+private:
+    template <size_t... I, typename... Values>
+    static void serialize_columns(char* row, std::index_sequence<I...>, const Values&... values) {
+        (Column<I>::write(row + offsets[I], values), ...);
+    }
+    template <size_t... I, typename... Outputs>
+    static void deserialize_columns(const char* row, std::index_sequence<I...>, Outputs*... outputs) {
+        (Column<I>::read_into(row + offsets[I], outputs), ...);
+    }
+    template <size_t... I, typename... Values>
+    static void scatter_columns(char* const* slots, std::index_sequence<I...>, const Values&... values) {
+        (Column<I>::write(slots[I], values), ...);
+    }
+    template <size_t... I, typename... Outputs>
+    static void gather_columns(const char* const* slots, std::index_sequence<I...>, Outputs*... outputs) {
+        (Column<I>::read_into(slots[I], outputs), ...);
+    }
+};
+
+#endif // SCHEMA_H
@@ -0,0 +1,176 @@
+#include "sink.h"
+#include <charconv>
+#include <sys/stat.h>
+
+// Longest a single formatted row can get: every string byte escaped or
+// doubled, plus the id and separators.
+const uint32_t SINK_MAX_ROW_SIZE = 2 * (COLUMN_USERNAME_SIZE + COLUMN_EMAIL_SIZE) + 64;
+
+static void sink_write_header(ResultSink* sink);
+static void append_bytes(ResultSink* sink, const void* data, uint32_t length);
+static void append_uint32(ResultSink* sink, uint32_t value);
+static void append_csv_field(ResultSink* sink, std::string_view field);
+static void append_tsv_field(ResultSink* sink, std::string_view field);
+
+
+bool parse_sink_format(const std::string& name, SinkFormat* format) {
+    if (name == "text") {
+        *format = SINK_TEXT;
+    } else if (name == "csv") {
+        *format = SINK_CSV;
+    } else if (name == "tsv") {
+        *format = SINK_TSV;
+    } else if (name == "binary") {
+        *format = SINK_BINARY;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+ResultSink* sink_open(int file_descriptor, SinkFormat format) {
+    ResultSink* sink = new ResultSink();
+    sink->file_descriptor = file_descriptor;
+    sink->owns_file = false;
+    sink->format = format;
+    sink->buffer = (char*)malloc(SINK_BUFFER_SIZE);
+    sink->buffer_used = 0;
+    sink->rows_written = 0;
+    sink_write_header(sink);
+    return sink;
+}
+
+ResultSink* sink_open_file(const std::string& filename, SinkFormat format) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        std::cerr << "Unable to open file '" << filename << "': " << strerror(errno) << std::endl;
+        return nullptr;
+    }
+    ResultSink* sink = sink_open(fd, format);
+    sink->owns_file = true;
+    return sink;
+}
+
+void sink_write_row(ResultSink* sink, const RowView& row) {
+    if (SINK_BUFFER_SIZE - sink->buffer_used < SINK_MAX_ROW_SIZE) {
+        sink_flush(sink);
+    }
+
+    std::string_view username = row.username();
+    std::string_view email = row.email();
+    switch (sink->format) {
+        case SINK_TEXT:
+            append_bytes(sink, "(", 1);
+            append_uint32(sink, row.id());
+            append_bytes(sink, ", ", 2);
+            append_bytes(sink, username.data(), username.size());
+            append_bytes(sink, ", ", 2);
+            append_bytes(sink, email.data(), email.size());
+            append_bytes(sink, ")\n", 2);
+            break;
+        case SINK_CSV:
+            append_uint32(sink, row.id());
+            append_bytes(sink, ",", 1);
+            append_csv_field(sink, username);
+            append_bytes(sink, ",", 1);
+            append_csv_field(sink, email);
+            append_bytes(sink, "\n", 1);
+            break;
+        case SINK_TSV:
+            append_uint32(sink, row.id());
+            append_bytes(sink, "\t", 1);
+            append_tsv_field(sink, username);
+            append_bytes(sink, "\t", 1);
+            append_tsv_field(sink, email);
+            append_bytes(sink, "\n", 1);
+            break;
+        case SINK_BINARY:
+            {
+            uint32_t payload_length = ID_SIZE + 2 * sizeof(uint16_t) + username.size() + email.size();
+            uint32_t id = row.id();
+            uint16_t username_length = username.size();
+            uint16_t email_length = email.size();
+            append_bytes(sink, &payload_length, sizeof(payload_length));
+            append_bytes(sink, &id, sizeof(id));
+            append_bytes(sink, &username_length, sizeof(username_length));
+            append_bytes(sink, username.data(), username_length);
+            append_bytes(sink, &email_length, sizeof(email_length));
+            append_bytes(sink, email.data(), email_length);
+            }
+            break;
+    }
+    sink->rows_written++;
+}
+
+void sink_flush(ResultSink* sink) {
+    uint32_t written = 0;
+    while (written < sink->buffer_used) {
+        ssize_t result = write(sink->file_descriptor, sink->buffer + written, sink->buffer_used - written);
+        if (result == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error writing results: " << strerror(errno) << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        written += result;
+    }
+    sink->buffer_used = 0;
+}
+
+void sink_close(ResultSink* sink) {
+    sink_flush(sink);
+    if (sink->owns_file && close(sink->file_descriptor) == -1) {
+        std::cerr << "Error closing result file: " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    free(sink->buffer);
+    delete sink;
+}
+
+
+static void sink_write_header(ResultSink* sink) {
+    if (sink->format == SINK_CSV) {
+        append_bytes(sink, "id,username,email\n", 18);
+    } else if (sink->format == SINK_TSV) {
+        append_bytes(sink, "id\tusername\temail\n", 18);
+    }
+}
+
+static void append_bytes(ResultSink* sink, const void* data, uint32_t length) {
+    memcpy(sink->buffer + sink->buffer_used, data, length);
+    sink->buffer_used += length;
+}
+
+static void append_uint32(ResultSink* sink, uint32_t value) {
+    char* start = sink->buffer + sink->buffer_used;
+    std::to_chars_result result = std::to_chars(start, start + 10, value);
+    sink->buffer_used += result.ptr - start;
+}
+
+static void append_csv_field(ResultSink* sink, std::string_view field) {
+    if (field.find_first_of(",\"\r\n") == std::string_view::npos) {
+        append_bytes(sink, field.data(), field.size());
+        return;
+    }
+    append_bytes(sink, "\"", 1);
+    for (char c : field) {
+        if (c == '"') {
+            append_bytes(sink, "\"\"", 2);
+        } else {
+            append_bytes(sink, &c, 1);
+        }
+    }
+    append_bytes(sink, "\"", 1);
+}
+
+static void append_tsv_field(ResultSink* sink, std::string_view field) {
+    for (char c : field) {
+        switch (c) {
+            case '\t': append_bytes(sink, "\\t", 2); break;
+            case '\n': append_bytes(sink, "\\n", 2); break;
+            case '\\': append_bytes(sink, "\\\\", 2); break;
+            default: append_bytes(sink, &c, 1); break;
+        }
+    }
+}
@@ -0,0 +1,36 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include "common.h"
+#include "row.h"
+
+// Output formats a result sink can produce.
+//  - SINK_TEXT:   "(id, username, email)" per line, as printed by the REPL.
+//  - SINK_CSV:    RFC 4180 with a header line; fields quoted when needed.
+//  - SINK_TSV:    tab separated with a header line; \t, \n and \\ escaped.
+//  - SINK_BINARY: per row, a uint32 payload length followed by the payload:
+//                 uint32 id, uint16 username length, username bytes,
+//                 uint16 email length, email bytes (host byte order).
+enum SinkFormat { SINK_TEXT, SINK_CSV, SINK_TSV, SINK_BINARY };
+
+// Rows are formatted into one large buffer that is handed to write(2) only
+// when full, so a scan costs a syscall per megabyte instead of per row.
+const uint32_t SINK_BUFFER_SIZE = 1 << 20;
+
+struct ResultSink {
+    int file_descriptor;
+    bool owns_file;
+    SinkFormat format;
+    char* buffer;
+    uint32_t buffer_used;
+    uint64_t rows_written;
+};
+
+bool parse_sink_format(const std::string& name, SinkFormat* format);
+ResultSink* sink_open(int file_descriptor, SinkFormat format);
+ResultSink* sink_open_file(const std::string& filename, SinkFormat format);
+void sink_write_row(ResultSink* sink, const RowView& row);
+void sink_flush(ResultSink* sink);
+void sink_close(ResultSink* sink);
+
+#endif // SINK_H
@@ -1,170 +1,1066 @@
 #include "table.h"
 #include "btree.h"
+#include "metrics.h"
+#include "explain.h"
+#include <algorithm>
 
 // Static forward declarations for internal helper functions
-static Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key);
-static Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key);
+static Cursor* leaf_node_find(Table* table, uint32_t page_num, void* node, uint32_t key);
+static uint32_t leaf_node_lower_bound(const NodeLayout& layout, void* node, uint32_t key);
+static Database* database_open(const std::string& filename, const PagerOptions& options, bool create_default_table);
+static Table* new_table(Pager* pager, uint32_t root_page_num, const std::string& name, LeafLayout leaf_layout);
+static uint32_t create_root_leaf(Pager* pager, LeafLayout leaf_layout);
+static void catalog_insert(Database* database, const Table* table);
+static char* catalog_record(Table* catalog, Cursor* cursor);
+static void upgrade_legacy_file(Pager* pager);
+static void upgrade_file(Pager* pager);
+static void upgrade_leaf_layout(Table* table);
+static void upgrade_packed_keys(Table* table);
+static void upgrade_to_catalog(Pager* pager);
+static void upgrade_catalog_records(Table* catalog);
+static void cursor_readahead(Cursor* cursor, bool backward);
+static void save_warm_list(Pager* pager);
+static void* table_find_leaf(Table* table, uint32_t key, uint32_t* page_num, uint32_t* upper_bound);
+static void node_prefetch_probes(const NodeLayout& layout, void* node);
+static const char* leaf_node_search_lanes(const NodeLayout& layout, void* node, uint32_t* lane_size);
+static uint64_t aggregate_column_value(AggregateColumn column, const char* slot);
 
 
-Table* db_open(const std::string& filename) {
-    Pager* pager = pager_open(filename);
+Database* db_open(const std::string& filename, const PagerOptions& options) {
+    return database_open(filename, options, true);
+}
+
+// Opens the file and every table in its catalog. A new file gets an empty
+// catalog and, unless `create_default_table` is false, an empty users
+// table; files of an older format are upgraded first.
+static Database* database_open(const std::string& filename, const PagerOptions& options, bool create_default_table) {
+    Pager* pager = pager_open(filename, options);
+    Database* database = new Database();
+    database->pager = pager;
+    database->layout = node_layout(pager->page_size, LEAF_LAYOUT_ROW);
+    database->filename = filename;
+    database->options = options;
+
+    if (pager->is_legacy_format) {
+        upgrade_legacy_file(pager);
+    }
+    bool is_new = pager_root_page_num(pager) == 0;
+    if (is_new) {
+        pager_set_root_page_num(pager, create_root_leaf(pager, LEAF_LAYOUT_ROW));
+        pager_set_format_version(pager, DB_FORMAT_VERSION);
+    } else if (pager->format_version != DB_FORMAT_VERSION) {
+        upgrade_file(pager);
+    }
+
+    database->catalog = new_table(pager, pager_root_page_num(pager), CATALOG_TABLE_NAME, LEAF_LAYOUT_ROW);
+    Cursor* cursor = table_start(database->catalog);
+    while (!(cursor->end_of_table)) {
+        // Catalog leaves are laid out by row, so a record starts at its first column.
+        const char* record = cursor_row(cursor).columns[USERS_COLUMN_ID];
+        std::string name(CatalogSchema::get<CATALOG_COLUMN_NAME>(record));
+        uint32_t leaf_layout = CatalogSchema::get<CATALOG_COLUMN_LEAF_LAYOUT>(record);
+        if (leaf_layout > LEAF_LAYOUT_PAX || CatalogSchema::get<CATALOG_COLUMN_NUM_COLUMNS>(record) != UsersSchema::num_columns ||
+            CatalogSchema::get<CATALOG_COLUMN_ROW_SIZE>(record) != ROW_SIZE) {
+            std::cerr << "Table '" << name << "' has a schema this build does not support." << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        database->tables.push_back(new_table(pager, CatalogSchema::get<CATALOG_COLUMN_ROOT_PAGE>(record), name, (LeafLayout)leaf_layout));
+        cursor_advance(cursor);
+    }
+    delete cursor;
+    if (is_new && create_default_table) {
+        db_create_table(database, DEFAULT_TABLE_NAME, LEAF_LAYOUT_ROW);
+    }
+
+    Table* default_table = db_table(database, DEFAULT_TABLE_NAME);
+    metrics_gauge_set(METRIC_GAUGE_TREE_HEIGHT, default_table != nullptr ? table_height(default_table) : 0);
+    metrics_gauge_set(METRIC_GAUGE_FREE_PAGES, pager_free_page_count(pager));
+    pager_warm_up(pager);
+    return database;
+}
+
+static Table* new_table(Pager* pager, uint32_t root_page_num, const std::string& name, LeafLayout leaf_layout) {
     Table* table = new Table();
     table->pager = pager;
-    table->root_page_num = 0;
+    table->root_page_num = root_page_num;
+    table->layout = node_layout(pager->page_size, leaf_layout);
+    table->name = name;
+    return table;
+}
+
+static uint32_t create_root_leaf(Pager* pager, LeafLayout leaf_layout) {
+    uint32_t root_page_num = get_unused_page_num(pager);
+    void* root_node = get_page(pager, root_page_num);
+    initialize_leaf_node(root_node, node_layout(pager->page_size, leaf_layout));
+    set_node_root(root_node, true);
+    return root_page_num;
+}
+
+Table* db_table(Database* database, const std::string& name) {
+    for (Table* table : database->tables) {
+        if (table->name == name) {
+            return table;
+        }
+    }
+    return nullptr;
+}
 
-    if (pager->num_pages == 0) {
-        void* root_node = get_page(pager, 0);
-        initialize_leaf_node(root_node);
-        set_node_root(root_node, true);
+Table* db_create_table(Database* database, const std::string& name, LeafLayout leaf_layout) {
+    if (db_table(database, name) != nullptr) {
+        return nullptr;
     }
+    pager_begin_operation(database->pager);
+    Table* table = new_table(database->pager, create_root_leaf(database->pager, leaf_layout), name, leaf_layout);
+    catalog_insert(database, table);
+    database->tables.push_back(table);
     return table;
 }
 
-void db_close(Table* table) {
+bool db_drop_table(Database* database, const std::string& name) {
+    Table* table = db_table(database, name);
+    if (table == nullptr) {
+        return false;
+    }
+    table_truncate(table);
+    pager_free_page(database->pager, table->root_page_num);
+    table_delete(database->catalog, table->root_page_num);
+    database->tables.erase(std::find(database->tables.begin(), database->tables.end(), table));
+    delete table;
+    metrics_gauge_set(METRIC_GAUGE_FREE_PAGES, pager_free_page_count(database->pager));
+    return true;
+}
+
+// Inserts the table's key with a zeroed value, then writes its record over
+// the front of that value.
+static void catalog_insert(Database* database, const Table* table) {
+    Row row = {};
+    row.id = table->root_page_num;
+    table_insert(database->catalog, &row);
+    Cursor* cursor = table_find(database->catalog, table->root_page_num);
+    CatalogSchema::serialize(catalog_record(database->catalog, cursor), table->root_page_num, table->name.c_str(),
+                             (uint32_t)table->layout.leaf_layout, UsersSchema::num_columns, ROW_SIZE);
+    delete cursor;
+}
+
+// The record at the cursor, for writing. Catalog leaves are laid out by
+// row, so a cell's value is one contiguous slot from its first column on.
+static char* catalog_record(Table* catalog, Cursor* cursor) {
+    pager_begin_operation(catalog->pager);
+    void* page = get_page(catalog->pager, cursor->page_num);
+    return leaf_node_column(catalog->layout, page, cursor->cell_num, USERS_COLUMN_ID);
+}
+
+// Files written before the header page kept the root at page 0. Move the
+// root to a fresh page and write the header into page 0. The root's
+// children are pointed at its new location by upgrade_file, which such a
+// file goes through next, once its internal nodes are in the current
+// layout.
+static void upgrade_legacy_file(Pager* pager) {
+    uint32_t root_page_num = get_unused_page_num(pager);
+    void* old_root = get_page(pager, 0);
+    void* new_root = get_page(pager, root_page_num);
+    memcpy(new_root, old_root, pager->page_size);
+    pager_initialize_header(pager);
+    pager_set_root_page_num(pager, root_page_num);
+    pager_flush_all(pager);
+}
+
+// Brings a file of an older format version up to date in steps: every
+// tree's internal nodes are repacked first, as nothing else can descend
+// through them before, then its row leaves are rewritten with packed keys,
+// a version 1 to 3 file's single tree is listed in a new catalog as the
+// users table, and a version 4 catalog's rows become records. The new
+// version is recorded, and the file flushed, once every step is done.
+static void upgrade_file(Pager* pager) {
+    uint32_t version = pager->format_version;
+    if (version <= DB_FORMAT_VERSION_SINGLE_TABLE) {
+        Table* table = new_table(pager, pager_root_page_num(pager), DEFAULT_TABLE_NAME, LEAF_LAYOUT_ROW);
+        btree_pack_internal_keys(table);
+        if (version == DB_FORMAT_VERSION_SINGLE_TABLE) {
+            upgrade_packed_keys(table);
+        } else {
+            upgrade_leaf_layout(table);
+        }
+        delete table;
+        upgrade_to_catalog(pager);
+    } else {
+        Table* catalog = new_table(pager, pager_root_page_num(pager), CATALOG_TABLE_NAME, LEAF_LAYOUT_ROW);
+        btree_pack_internal_keys(catalog);
+        if (version <= DB_FORMAT_VERSION_UNPACKED_KEYS) {
+            upgrade_packed_keys(catalog);
+        }
+        if (version == DB_FORMAT_VERSION_TEXT_CATALOG) {
+            upgrade_catalog_records(catalog);
+        }
+        Cursor* cursor = table_start(catalog);
+        while (!(cursor->end_of_table)) {
+            const char* record = cursor_row(cursor).columns[USERS_COLUMN_ID];
+            LeafLayout leaf_layout = (LeafLayout)CatalogSchema::get<CATALOG_COLUMN_LEAF_LAYOUT>(record);
+            Table* table = new_table(pager, CatalogSchema::get<CATALOG_COLUMN_ROOT_PAGE>(record),
+                                     std::string(CatalogSchema::get<CATALOG_COLUMN_NAME>(record)), leaf_layout);
+            btree_pack_internal_keys(table);
+            if (leaf_layout == LEAF_LAYOUT_ROW && version <= DB_FORMAT_VERSION_UNPACKED_KEYS) {
+                upgrade_packed_keys(table);
+            }
+            delete table;
+            cursor_advance(cursor);
+        }
+        delete cursor;
+        delete catalog;
+    }
+    pager_set_format_version(pager, DB_FORMAT_VERSION);
+    pager_flush_all(pager);
+}
+
+// Format version 1 kept each key next to its value, in cells following a
+// header with neither the values offset nor the previous-leaf link; version
+// 2 stored keys and values apart but had no previous-leaf link either. Both
+// keep the cell count and next link where they are now. Rewrites every leaf
+// on the chain in the current layout, linking each to the leaf before it.
+// The extra header fields cost no cell at any supported page size, so every
+// leaf still fits, and these files predate PAX leaves, so each value is
+// copied whole.
+static void upgrade_leaf_layout(Table* table) {
+    const uint32_t interleaved_header_size = LEAF_NODE_NEXT_LEAF_OFFSET + LEAF_NODE_NEXT_LEAF_SIZE;
     Pager* pager = table->pager;
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == nullptr) {
-            continue;
+    bool interleaved = pager->format_version == DB_FORMAT_VERSION_INTERLEAVED_LEAVES;
+    pager_begin_operation(pager);
+    uint32_t page_num = table->root_page_num;
+    void* node = get_page_for_read(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = *internal_node_child(node, 0);
+        node = get_page_for_read(pager, page_num);
+    }
+
+    std::vector<char> old_leaf(pager->page_size);
+    uint32_t prev_leaf = 0;
+    while (page_num != 0) {
+        pager_begin_operation(pager);
+        void* leaf = get_page(pager, page_num);
+        memcpy(old_leaf.data(), leaf, pager->page_size);
+        uint32_t num_cells = *leaf_node_num_cells(leaf);
+        uint32_t next_leaf = *leaf_node_next_leaf(leaf);
+        uint32_t parent_page_num = *node_parent(leaf);
+        bool is_root = is_node_root(leaf);
+        uint32_t old_values_start;
+        memcpy(&old_values_start, old_leaf.data() + interleaved_header_size, sizeof(old_values_start));
+
+        initialize_leaf_node(leaf, table->layout);
+        set_node_root(leaf, is_root);
+        *node_parent(leaf) = parent_page_num;
+        *leaf_node_next_leaf(leaf) = next_leaf;
+        *leaf_node_prev_leaf(leaf) = prev_leaf;
+        *leaf_node_num_cells(leaf) = num_cells;
+        for (uint32_t i = 0; i < num_cells; i++) {
+            if (interleaved) {
+                const char* cell = old_leaf.data() + interleaved_header_size + i * LEAF_NODE_CELL_SIZE;
+                memcpy(leaf_node_column(table->layout, leaf, i, USERS_COLUMN_ID), cell + LEAF_NODE_KEY_SIZE, LEAF_NODE_VALUE_SIZE);
+            } else {
+                memcpy(leaf_node_column(table->layout, leaf, i, USERS_COLUMN_ID), old_leaf.data() + old_values_start + i * LEAF_NODE_VALUE_SIZE,
+                       LEAF_NODE_VALUE_SIZE);
+            }
         }
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = nullptr;
+        leaf_node_index_keys(table->layout, leaf);
+        prev_leaf = page_num;
+        page_num = next_leaf;
     }
+}
 
-    int result = close(pager->file_descriptor);
-    if (result == -1) {
-        std::cerr << "Error closing db file." << std::endl;
-        exit(EXIT_FAILURE);
+// Versions 3 to 5 kept a row leaf's keys whole, with the values right after
+// them. Moves each leaf's values up past the key frame and packs its keys;
+// the frame costs no cell at any supported page size. Only leaves change.
+static void upgrade_packed_keys(Table* table) {
+    Pager* pager = table->pager;
+    pager_begin_operation(pager);
+    uint32_t page_num = table->root_page_num;
+    void* node = get_page_for_read(pager, page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        page_num = *internal_node_child(node, 0);
+        node = get_page_for_read(pager, page_num);
+    }
+
+    while (page_num != 0) {
+        pager_begin_operation(pager);
+        void* leaf = get_page(pager, page_num);
+        memmove((char*)leaf + table->layout.leaf_values_start, (char*)leaf + *leaf_node_values_start(leaf),
+                *leaf_node_num_cells(leaf) * LEAF_NODE_VALUE_SIZE);
+        *leaf_node_values_start(leaf) = table->layout.leaf_values_start;
+        leaf_node_index_keys(table->layout, leaf);
+        page_num = *leaf_node_next_leaf(leaf);
     }
-    delete pager;
+}
+
+// Before version 4 the header pointed at the file's only tree. It becomes
+// the users table: a catalog is created with a record for it, and the
+// header is pointed at the catalog instead.
+static void upgrade_to_catalog(Pager* pager) {
+    Database database = {};
+    database.pager = pager;
+    database.layout = node_layout(pager->page_size, LEAF_LAYOUT_ROW);
+    Table* table = new_table(pager, pager_root_page_num(pager), DEFAULT_TABLE_NAME, LEAF_LAYOUT_ROW);
+    database.catalog = new_table(pager, create_root_leaf(pager, LEAF_LAYOUT_ROW), CATALOG_TABLE_NAME, LEAF_LAYOUT_ROW);
+    catalog_insert(&database, table);
+    pager_set_root_page_num(pager, database.catalog->root_page_num);
     delete table;
+    delete database.catalog;
 }
 
-void table_insert(Table* table, Row* row_to_insert) {
+// Version 4 catalogs kept each table in a users row: the name in the
+// username column and its schema as text in the email column, ending in
+// " using pax" for PAX leaves. Rewrites each row as a record in place; the
+// keys, and so the tree, stay as they are.
+static void upgrade_catalog_records(Table* catalog) {
+    const char* const pax_schema_text = "id integer primary key, username varchar(32), email varchar(255) using pax";
+    Cursor* cursor = table_start(catalog);
+    while (!(cursor->end_of_table)) {
+        Row row;
+        cursor_row(cursor).read(&row);
+        LeafLayout leaf_layout = strcmp(row.email, pax_schema_text) == 0 ? LEAF_LAYOUT_PAX : LEAF_LAYOUT_ROW;
+        char* record = catalog_record(catalog, cursor);
+        memset(record, 0, ROW_SIZE);
+        CatalogSchema::serialize(record, row.id, row.username, (uint32_t)leaf_layout, UsersSchema::num_columns, ROW_SIZE);
+        cursor_advance(cursor);
+    }
+    delete cursor;
+}
+
+void db_close(Database* database) {
+    save_warm_list(database->pager);
+    pager_close(database->pager);
+    for (Table* table : database->tables) {
+        delete table;
+    }
+    delete database->catalog;
+    delete database;
+}
+
+// Writes every dirty page and records the current hot set for the next
+// open, without closing the database.
+void db_checkpoint(Database* database) {
+    pager_flush_all(database->pager);
+    save_warm_list(database->pager);
+}
+
+// Rebuilds every table into a new file with btree_bulk_load, one after the
+// other, each with its leaves in key order in consecutive pages, then lists
+// them in a new catalog and renames the file over the old one, which stays
+// intact until then. The free list goes with the old file, and the warm-up
+// list, which names old page numbers, is dropped. Open tables keep their
+// Table objects, now pointing at the new file. Returns the number of pages
+// in the new file.
+uint32_t db_reorganize(Database* database, uint32_t fill_percent) {
+    std::string temporary_path = database->filename + REORGANIZE_SUFFIX;
+    unlink(temporary_path.c_str());
+    PagerOptions options = database->options;
+    options.page_size = database->pager->page_size;
+    options.compress = database->pager->compressed;
+    Database* rebuilt = database_open(temporary_path, options, false);
+
+    // Catalog rows are added last, so that no catalog split lands inside
+    // the run of pages a bulk load is writing.
+    for (Table* table : database->tables) {
+        uint32_t num_rows = table_row_count(table);
+        Cursor* source = table_start(table);
+        pager_begin_operation(rebuilt->pager);
+        Table* copy = new_table(rebuilt->pager, get_unused_page_num(rebuilt->pager), table->name, table->layout.leaf_layout);
+        btree_bulk_load(copy, source, num_rows, fill_percent);
+        delete source;
+        rebuilt->tables.push_back(copy);
+    }
+    for (Table* copy : rebuilt->tables) {
+        catalog_insert(rebuilt, copy);
+    }
+    uint32_t num_pages = rebuilt->pager->num_pages;
+    pager_close(rebuilt->pager);
+    for (Table* copy : rebuilt->tables) {
+        delete copy;
+    }
+    delete rebuilt->catalog;
+    delete rebuilt;
+
+    pager_close(database->pager);
+    if (rename(temporary_path.c_str(), database->filename.c_str()) == -1) {
+        std::cerr << "Unable to replace '" << database->filename << "': " << strerror(errno) << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    unlink((database->filename + WARM_LIST_SUFFIX).c_str());
+    Database* reopened = db_open(database->filename, database->options);
+    for (Table*& table : reopened->tables) {
+        Table* existing = db_table(database, table->name);
+        *existing = *table;
+        delete table;
+        table = existing;
+    }
+    *database->catalog = *reopened->catalog;
+    delete reopened->catalog;
+    reopened->catalog = database->catalog;
+    *database = *reopened;
+    delete reopened;
+    return num_pages;
+}
+
+// The hot set is every cached internal node, which each lookup passes
+// through, followed by the cached leaves in order of use.
+static void save_warm_list(Pager* pager) {
+    std::vector<uint32_t> page_nums;
+    pager_hot_pages(pager, &page_nums);
+    if (page_nums.empty()) {
+        return;
+    }
+    pager_begin_operation(pager);
+    std::stable_partition(page_nums.begin(), page_nums.end(), [pager](uint32_t page_num) {
+        return get_node_type(get_page_for_read(pager, page_num)) == NODE_INTERNAL;
+    });
+    pager_save_warm_list(pager, page_nums);
+}
+
+ExecuteResult table_insert(Table* table, Row* row_to_insert) {
     uint32_t key_to_insert = row_to_insert->id;
     Cursor* cursor = table_find(table, key_to_insert);
 
-    void* node = get_page(table->pager, cursor->page_num);
+    void* node = get_page_for_read(table->pager, cursor->page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
 
     if (cursor->cell_num < num_cells) {
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
+        uint32_t key_at_index = leaf_node_key(table->layout, node, cursor->cell_num);
         if (key_at_index == key_to_insert) {
-            std::cout << "Error: Duplicate key." << std::endl;
             delete cursor;
-            return;
+            return EXECUTE_DUPLICATE_KEY;
         }
     }
 
+    explain_phase(table->pager->trace, PHASE_MODIFY);
     leaf_node_insert(table, cursor->page_num, cursor->cell_num, row_to_insert->id, row_to_insert);
     delete cursor;
-    std::cout << "Executed." << std::endl;
+    return EXECUTE_SUCCESS;
+}
+
+// Inserts `num_rows` rows and stores each one's outcome in `results`, in
+// input order; an id repeated within the batch is a duplicate of its first
+// occurrence. The rows are sorted and split into runs that belong in the
+// same leaf, and each run costs one descent and one merge into the leaf,
+// however many rows it holds. Returns the number of rows inserted.
+uint32_t table_insert_batch(Table* table, Row* rows, uint32_t num_rows, ExecuteResult* results) {
+    std::vector<uint32_t> order(num_rows);
+    for (uint32_t i = 0; i < num_rows; i++) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [rows](uint32_t a, uint32_t b) {
+        return rows[a].id < rows[b].id;
+    });
+
+    uint32_t inserted = 0;
+    std::vector<Row*> run;
+    for (uint32_t next = 0; next < num_rows;) {
+        uint32_t page_num;
+        uint32_t upper_bound;
+        void* leaf = table_find_leaf(table, rows[order[next]].id, &page_num, &upper_bound);
+        uint32_t num_cells = *leaf_node_num_cells(leaf);
+        run.clear();
+        for (; next < num_rows && rows[order[next]].id <= upper_bound; next++) {
+            Row* row = &rows[order[next]];
+            uint32_t cell_num = leaf_node_lower_bound(table->layout, leaf, row->id);
+            bool duplicate = (!run.empty() && run.back()->id == row->id) ||
+                             (cell_num < num_cells && leaf_node_key(table->layout, leaf, cell_num) == row->id);
+            results[order[next]] = duplicate ? EXECUTE_DUPLICATE_KEY : EXECUTE_SUCCESS;
+            if (!duplicate) {
+                run.push_back(row);
+            }
+        }
+        if (!run.empty()) {
+            explain_phase(table->pager->trace, PHASE_MODIFY);
+            leaf_node_insert_batch(table, page_num, run.data(), run.size());
+            inserted += run.size();
+        }
+    }
+    return inserted;
+}
+
+// Descends to the leaf where `key` belongs, like table_find, and also
+// reports the largest key that belongs in that leaf: the nearest separator
+// to the right of the path, or UINT32_MAX for the last leaf.
+static void* table_find_leaf(Table* table, uint32_t key, uint32_t* page_num, uint32_t* upper_bound) {
+    Pager* pager = table->pager;
+    pager_begin_operation(pager);
+    *page_num = table->root_page_num;
+    *upper_bound = UINT32_MAX;
+    uint32_t frame_index;
+    void* node = pager_descend_root(pager, *page_num, &frame_index);
+    explain_begin_descent(pager->trace);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        explain_path_step(pager->trace, *page_num);
+        uint32_t child_index = internal_node_find_child(node, key);
+        if (child_index < *internal_node_num_keys(node)) {
+            *upper_bound = std::min(*upper_bound, internal_node_key(node, child_index));
+        }
+        *page_num = *internal_node_child(node, child_index);
+        node = pager_descend(pager, &frame_index, child_index, *page_num);
+    }
+    explain_path_step(pager->trace, *page_num);
+    return node;
 }
 
-void table_delete(Table* table, uint32_t key) {
+ExecuteResult table_delete(Table* table, uint32_t key) {
     Cursor* cursor = table_find(table, key);
-    void* node = get_page(table->pager, cursor->page_num);
+    void* node = get_page_for_read(table->pager, cursor->page_num);
+    ExecuteResult result = EXECUTE_KEY_NOT_FOUND;
 
-    if (cursor->cell_num < *leaf_node_num_cells(node) && *leaf_node_key(node, cursor->cell_num) == key) {
+    if (cursor->cell_num < *leaf_node_num_cells(node) && leaf_node_key(table->layout, node, cursor->cell_num) == key) {
+        explain_phase(table->pager->trace, PHASE_MODIFY);
         btree_delete(table, cursor->page_num, cursor->cell_num, key);
-        std::cout << "Executed." << std::endl;
+        result = EXECUTE_SUCCESS;
+    }
+    delete cursor;
+    return result;
+}
+
+// Deletes the rows with ids in [start_key, end_key] and returns how many
+// there were. The tree is cut along the two ends of the range in one pass
+// (see btree_delete_range); the rows just outside it are found first, by
+// rank, so their leaves can be relinked and the edges rebalanced after.
+uint32_t table_delete_range(Table* table, uint32_t start_key, uint32_t end_key) {
+    uint32_t count = table_count_range(table, start_key, end_key);
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t total = table_row_count(table);
+    if (count == total) {
+        table_truncate(table);
+        return count;
+    }
+    uint32_t first = table_rank(table, start_key);
+    uint32_t height = table_height(table);
+    Cursor* before = first > 0 ? table_find_nth(table, first - 1) : nullptr;
+    Cursor* after = first + count < total ? table_find_nth(table, first + count) : nullptr;
+
+    Pager* pager = table->pager;
+    pager_begin_operation(pager);
+    uint32_t before_key = before ? leaf_node_key(table->layout, get_page_for_read(pager, before->page_num), before->cell_num) : 0;
+    uint32_t after_key = after ? leaf_node_key(table->layout, get_page_for_read(pager, after->page_num), after->cell_num) : 0;
+    explain_phase(pager->trace, PHASE_MODIFY);
+    btree_delete_range(table, table->root_page_num, height - 1, start_key, end_key);
+    // Rows on both sides of the range may share a leaf, whose links stay.
+    if (before == nullptr || after == nullptr || after->page_num != before->page_num) {
+        if (before != nullptr) {
+            *leaf_node_next_leaf(get_page(pager, before->page_num)) = after ? after->page_num : 0;
+        }
+        if (after != nullptr) {
+            *leaf_node_prev_leaf(get_page(pager, after->page_num)) = before ? before->page_num : 0;
+        }
+    }
+    if (before != nullptr) {
+        btree_rebalance_path(table, before_key);
+    }
+    if (after != nullptr) {
+        btree_rebalance_path(table, after_key);
+    }
+    delete before;
+    delete after;
+    return count;
+}
+
+// Deletes every row; all pages but the root go on the free list.
+void table_truncate(Table* table) {
+    uint32_t height = table_height(table);
+    pager_begin_operation(table->pager);
+    explain_phase(table->pager->trace, PHASE_MODIFY);
+    btree_truncate(table, height - 1);
+}
+
+// Overwrites the columns of `row` named in `columns` in the stored row with
+// the same id, writing only those columns. The cell stays where it is, so
+// nothing in the tree moves.
+ExecuteResult table_update(Table* table, const Row* row, uint32_t columns) {
+    Cursor* cursor = table_find(table, row->id);
+    void* node = get_page_for_read(table->pager, cursor->page_num);
+    ExecuteResult result = EXECUTE_KEY_NOT_FOUND;
+
+    if (cursor->cell_num < *leaf_node_num_cells(node) && leaf_node_key(table->layout, node, cursor->cell_num) == row->id) {
+        explain_phase(table->pager->trace, PHASE_MODIFY);
+        void* page = get_page(table->pager, cursor->page_num);
+        if (columns & UPDATE_USERNAME) {
+            char* slot = leaf_node_column(table->layout, page, cursor->cell_num, USERS_COLUMN_USERNAME);
+            UsersSchema::Column<USERS_COLUMN_USERNAME>::write(slot, row->username);
+        }
+        if (columns & UPDATE_EMAIL) {
+            char* slot = leaf_node_column(table->layout, page, cursor->cell_num, USERS_COLUMN_EMAIL);
+            UsersSchema::Column<USERS_COLUMN_EMAIL>::write(slot, row->email);
+        }
+        result = EXECUTE_SUCCESS;
+    }
+    delete cursor;
+    return result;
+}
+
+// Inserts `row`, or replaces the row with its id if there is one, in a
+// single descent.
+ExecuteResult table_upsert(Table* table, Row* row) {
+    Cursor* cursor = table_find(table, row->id);
+    void* node = get_page_for_read(table->pager, cursor->page_num);
+    explain_phase(table->pager->trace, PHASE_MODIFY);
+    if (cursor->cell_num < *leaf_node_num_cells(node) && leaf_node_key(table->layout, node, cursor->cell_num) == row->id) {
+        leaf_node_write_row(table->layout, get_page(table->pager, cursor->page_num), cursor->cell_num, row);
     } else {
-        std::cout << "Error: Key " << key << " not found." << std::endl;
+        leaf_node_insert(table, cursor->page_num, cursor->cell_num, row->id, row);
     }
     delete cursor;
+    return EXECUTE_SUCCESS;
+}
+
+// Point lookup; on a hit `row` views the row in page memory.
+bool table_lookup(Table* table, uint32_t key, RowView* row) {
+    Cursor* cursor = table_find(table, key);
+    void* node = get_page_for_read(table->pager, cursor->page_num);
+    bool found = cursor->cell_num < *leaf_node_num_cells(node) && leaf_node_key(table->layout, node, cursor->cell_num) == key;
+    if (found) {
+        *row = leaf_node_row(table->layout, node, cursor->cell_num);
+    }
+    delete cursor;
+    return found;
+}
+
+// --- Multi-Get ---
+// One lookup of a multi-get group, between levels of the descent.
+struct MultigetLookup {
+    uint32_t index; // into the caller's arrays
+    uint32_t frame_index;
+    uint32_t child_index;
+    uint32_t child_page_num;
+    void* node;
+};
+
+// Looks up `num_keys` ids at once. For each `keys[i]`, `found[i]` says
+// whether it exists and, if so, `rows[i]` receives a copy of the row.
+// Lookups run in key order, MULTIGET_GROUP_SIZE at a time, and a group
+// descends in lockstep: it picks every child of one level, starts reading
+// the ones not in the pool as one batch, then fetches each child and
+// prefetches the cache lines its search will touch before any of them is
+// searched. While one node's lines are still on their way the others are
+// being worked on, so the group waits for memory and disk about once per
+// level instead of once per lookup and level. Returns the number found.
+uint32_t table_multiget(Table* table, const uint32_t* keys, uint32_t num_keys, Row* rows, bool* found) {
+    Pager* pager = table->pager;
+    std::vector<uint32_t> order(num_keys);
+    for (uint32_t i = 0; i < num_keys; i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [keys](uint32_t a, uint32_t b) {
+        return keys[a] < keys[b];
+    });
+
+    uint32_t num_found = 0;
+    std::vector<MultigetLookup> group;
+    std::vector<uint32_t> page_nums;
+    for (uint32_t first = 0; first < num_keys; first += MULTIGET_GROUP_SIZE) {
+        pager_begin_operation(pager);
+        pager_advise(pager, ACCESS_RANDOM);
+        group.clear();
+        for (uint32_t i = first; i < std::min(num_keys, first + MULTIGET_GROUP_SIZE); i++) {
+            MultigetLookup lookup = {order[i], NO_FRAME, 0, 0, nullptr};
+            lookup.node = pager_descend_root(pager, table->root_page_num, &lookup.frame_index);
+            group.push_back(lookup);
+        }
+
+        // The tree is balanced, so every lookup reaches the leaves together.
+        while (get_node_type(group[0].node) == NODE_INTERNAL) {
+            page_nums.clear();
+            for (MultigetLookup& lookup : group) {
+                lookup.child_index = internal_node_find_child(lookup.node, keys[lookup.index]);
+                lookup.child_page_num = *internal_node_child(lookup.node, lookup.child_index);
+                page_nums.push_back(lookup.child_page_num);
+            }
+            // With mmap every prefetch is a madvise call, even for pages
+            // already in memory; the kernel is left to fault them in.
+            if (pager->backend != PAGER_BACKEND_MMAP) {
+                pager_prefetch(pager, page_nums.data(), page_nums.size());
+            }
+            for (MultigetLookup& lookup : group) {
+                lookup.node = pager_descend(pager, &lookup.frame_index, lookup.child_index, lookup.child_page_num);
+                __builtin_prefetch(lookup.node);
+            }
+            for (MultigetLookup& lookup : group) {
+                node_prefetch_probes(table->layout, lookup.node);
+            }
+        }
+
+        for (MultigetLookup& lookup : group) {
+            uint32_t key = keys[lookup.index];
+            uint32_t cell_num = leaf_node_lower_bound(table->layout, lookup.node, key);
+            found[lookup.index] = cell_num < *leaf_node_num_cells(lookup.node) && leaf_node_key(table->layout, lookup.node, cell_num) == key;
+            if (found[lookup.index]) {
+                leaf_node_row(table->layout, lookup.node, cell_num).read(&rows[lookup.index]);
+                num_found++;
+            }
+        }
+    }
+    return num_found;
+}
+
+// Prefetches the keys a search of `node` probes first: the middle one and
+// the two at the quarters. The node's header must already be cached.
+static void node_prefetch_probes(const NodeLayout& layout, void* node) {
+    if (get_node_type(node) == NODE_LEAF) {
+        uint32_t num_cells = *leaf_node_num_cells(node);
+        uint32_t lane_size;
+        const char* lanes = leaf_node_search_lanes(layout, node, &lane_size);
+        for (uint32_t quarter = 1; quarter < 4; quarter++) {
+            __builtin_prefetch(lanes + num_cells * quarter / 4 * lane_size);
+        }
+    } else {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        uint32_t lane_size = *internal_node_key_width(node) / 8;
+        const char* lanes = internal_node_key_lanes(node);
+        for (uint32_t quarter = 1; quarter < 4; quarter++) {
+            __builtin_prefetch(lanes + num_keys * quarter / 4 * lane_size);
+        }
+    }
+}
+
+
+// Levels from the root down to the leaves, inclusive.
+uint32_t table_height(Table* table) {
+    pager_begin_operation(table->pager);
+    uint32_t frame_index;
+    void* node = pager_descend_root(table->pager, table->root_page_num, &frame_index);
+    uint32_t height = 1;
+    while (get_node_type(node) == NODE_INTERNAL) {
+        node = pager_descend(table->pager, &frame_index, 0, *internal_node_child(node, 0));
+        height++;
+    }
+    return height;
+}
+
+uint32_t table_row_count(Table* table) {
+    pager_begin_operation(table->pager);
+    return node_row_count(get_page_for_read(table->pager, table->root_page_num));
+}
+
+// Number of rows whose id is strictly less than `key`.
+uint32_t table_rank(Table* table, uint32_t key) {
+    Pager* pager = table->pager;
+    pager_begin_operation(pager);
+    uint32_t frame_index;
+    void* node = pager_descend_root(pager, table->root_page_num, &frame_index);
+    uint32_t rank = 0;
+    explain_begin_descent(pager->trace);
+    explain_path_step(pager->trace, table->root_page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t child_index = internal_node_find_child(node, key);
+        for (uint32_t i = 0; i < child_index; i++) {
+            rank += *internal_node_child_count(node, i);
+        }
+        uint32_t child_page_num = *internal_node_child(node, child_index);
+        explain_path_step(pager->trace, child_page_num);
+        node = pager_descend(pager, &frame_index, child_index, child_page_num);
+    }
+    return rank + leaf_node_lower_bound(table->layout, node, key);
+}
+
+uint32_t table_count_range(Table* table, uint32_t start_key, uint32_t end_key) {
+    if (start_key > end_key) {
+        return 0;
+    }
+    uint32_t end_rank = (end_key == UINT32_MAX) ? table_row_count(table) : table_rank(table, end_key + 1);
+    return end_rank - table_rank(table, start_key);
+}
+
+static uint64_t aggregate_column_value(AggregateColumn column, const char* slot) {
+    switch (column) {
+        case COLUMN_ID:
+            return UsersSchema::Column<USERS_COLUMN_ID>::read(slot);
+        case COLUMN_USERNAME_LENGTH:
+            return UsersSchema::Column<USERS_COLUMN_USERNAME>::read(slot).size();
+        default:
+            return UsersSchema::Column<USERS_COLUMN_EMAIL>::read(slot).size();
+    }
+}
+
+AggregateResult table_aggregate(Table* table, AggregateType type, AggregateColumn column, uint32_t start_key, uint32_t end_key) {
+    AggregateResult result = {false, 0};
+    uint32_t count = table_count_range(table, start_key, end_key);
+    if (type == AGGREGATE_COUNT) {
+        result.value = count;
+        return result;
+    }
+    if (count == 0) {
+        result.is_null = (type != AGGREGATE_SUM);
+        return result;
+    }
+
+    uint32_t first = table_rank(table, start_key);
+    if (column == COLUMN_ID && type != AGGREGATE_SUM) {
+        // Ids are the keys, so their extremes sit at the ends of the range.
+        Cursor* cursor = table_find_nth(table, type == AGGREGATE_MIN ? first : first + count - 1);
+        void* node = get_page_for_read(table->pager, cursor->page_num);
+        result.value = leaf_node_key(table->layout, node, cursor->cell_num);
+        delete cursor;
+        return result;
+    }
+
+    // Everything else is folded straight out of the leaf cells, a leaf at a
+    // time, reading only the aggregated column's slots: one per row in a
+    // row leaf, or a contiguous run of them in a PAX leaf.
+    const NodeLayout& layout = table->layout;
+    uint32_t schema_column = column == COLUMN_ID ? USERS_COLUMN_ID
+                             : column == COLUMN_USERNAME_LENGTH ? USERS_COLUMN_USERNAME : USERS_COLUMN_EMAIL;
+    Cursor* cursor = table_find_nth(table, first);
+    explain_phase(table->pager->trace, PHASE_SCAN);
+    for (uint32_t folded = 0; folded < count;) {
+        pager_begin_operation(table->pager);
+        void* node = get_page_for_read(table->pager, cursor->page_num);
+        uint32_t run = std::min(count - folded, *leaf_node_num_cells(node) - cursor->cell_num);
+        const char* slot = leaf_node_column(layout, node, cursor->cell_num, schema_column);
+        for (uint32_t i = 0; i < run; i++, slot += layout.column_stride[schema_column]) {
+            uint64_t value = aggregate_column_value(column, slot);
+            if (type == AGGREGATE_SUM) {
+                result.value += value;
+            } else if (folded + i == 0 || (type == AGGREGATE_MIN ? value < result.value : value > result.value)) {
+                result.value = value;
+            }
+        }
+        folded += run;
+        cursor->cell_num += run - 1;
+        cursor_advance(cursor);
+    }
+    delete cursor;
+    return result;
 }
 
 
-void* cursor_value(Cursor* cursor) {
-    void* page = get_page(cursor->table->pager, cursor->page_num);
-    return leaf_node_value(page, cursor->cell_num);
+RowView cursor_row(Cursor* cursor) {
+    pager_begin_operation(cursor->table->pager);
+    void* page = get_page_for_read(cursor->table->pager, cursor->page_num);
+    return leaf_node_row(cursor->table->layout, page, cursor->cell_num);
 }
 
 void cursor_advance(Cursor* cursor) {
-    void* node = get_page(cursor->table->pager, cursor->page_num);
+    pager_begin_operation(cursor->table->pager);
+    void* node = get_page_for_read(cursor->table->pager, cursor->page_num);
     cursor->cell_num += 1;
     if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
         uint32_t next_page_num = *leaf_node_next_leaf(node);
         if (next_page_num == 0) {
             cursor->end_of_table = true;
         } else {
+            // Walking the leaf chain: let the mmap backend read ahead.
+            pager_advise(cursor->table->pager, ACCESS_SEQUENTIAL);
             cursor->page_num = next_page_num;
             cursor->cell_num = 0;
+            cursor_readahead(cursor, false);
+        }
+    }
+}
+
+// Steps a cursor back one row, following the leaf chain backwards; it is at
+// the end once it moves past the first row. Only the root leaf is ever
+// empty, so the leaf before always has a last row.
+void cursor_retreat(Cursor* cursor) {
+    pager_begin_operation(cursor->table->pager);
+    if (cursor->cell_num > 0) {
+        cursor->cell_num -= 1;
+        return;
+    }
+    void* node = get_page_for_read(cursor->table->pager, cursor->page_num);
+    uint32_t prev_page_num = *leaf_node_prev_leaf(node);
+    if (prev_page_num == 0) {
+        cursor->end_of_table = true;
+        return;
+    }
+    cursor->page_num = prev_page_num;
+    cursor->cell_num = *leaf_node_num_cells(get_page_for_read(cursor->table->pager, prev_page_num)) - 1;
+    cursor_readahead(cursor, true);
+}
+
+// Once a cursor has stepped through READAHEAD_TRIGGER_LEAVES leaves in a
+// row, keeps the next readahead_window leaves prefetched. The upcoming
+// leaves are taken from the parent's child list, which names them without
+// reading any of them; the window is topped up when half of it is used.
+// Going backward, readahead_next_child is one past the next child to fetch.
+static void cursor_readahead(Cursor* cursor, bool backward) {
+    Pager* pager = cursor->table->pager;
+    uint32_t window = pager->readahead_window;
+    cursor->sequential_leaves++;
+    if (window == 0 || cursor->sequential_leaves < READAHEAD_TRIGGER_LEAVES) {
+        return;
+    }
+
+    void* leaf = get_page_for_read(pager, cursor->page_num);
+    if (is_node_root(leaf) || *leaf_node_num_cells(leaf) == 0) {
+        return;
+    }
+    uint32_t parent_page_num = *node_parent(leaf);
+    void* parent = get_page_for_read(pager, parent_page_num);
+    uint32_t child_index = internal_node_find_child(parent, leaf_node_key(cursor->table->layout, leaf, 0));
+    std::vector<uint32_t> page_nums;
+    if (backward) {
+        if (parent_page_num != cursor->readahead_parent || cursor->readahead_next_child > child_index) {
+            cursor->readahead_parent = parent_page_num;
+            cursor->readahead_next_child = child_index;
+        }
+        if (cursor->readahead_next_child + window / 2 <= child_index) {
+            return;
+        }
+        uint32_t start = child_index > window ? child_index - window : 0;
+        for (uint32_t i = cursor->readahead_next_child; i-- > start;) {
+            page_nums.push_back(*internal_node_child(parent, i));
         }
+        cursor->readahead_next_child = start;
+        pager_prefetch(pager, page_nums.data(), page_nums.size());
+        return;
     }
+
+    if (parent_page_num != cursor->readahead_parent || cursor->readahead_next_child <= child_index) {
+        cursor->readahead_parent = parent_page_num;
+        cursor->readahead_next_child = child_index + 1;
+    }
+    if (cursor->readahead_next_child > child_index + window / 2) {
+        return;
+    }
+
+    uint32_t num_keys = *internal_node_num_keys(parent);
+    uint32_t end = std::min(num_keys, child_index + window);
+    for (uint32_t i = cursor->readahead_next_child; i <= end; i++) {
+        page_nums.push_back(*internal_node_child(parent, i));
+    }
+    cursor->readahead_next_child = end + 1;
+    pager_prefetch(pager, page_nums.data(), page_nums.size());
 }
 
 Cursor* table_find(Table* table, uint32_t key) {
-    void* root_node = get_page(table->pager, table->root_page_num);
-    
-    if (get_node_type(root_node) == NODE_LEAF) {
-        return leaf_node_find(table, table->root_page_num, key);
-    } else {
-        return internal_node_find(table, table->root_page_num, key);
+    pager_begin_operation(table->pager);
+    pager_advise(table->pager, ACCESS_RANDOM);
+    Pager* pager = table->pager;
+    uint32_t page_num = table->root_page_num;
+    uint32_t frame_index;
+    void* node = pager_descend_root(pager, page_num, &frame_index);
+    explain_begin_descent(pager->trace);
+
+    while (get_node_type(node) == NODE_INTERNAL) {
+        explain_path_step(pager->trace, page_num);
+        uint32_t child_index = internal_node_find_child(node, key);
+        page_num = *internal_node_child(node, child_index);
+        node = pager_descend(pager, &frame_index, child_index, page_num);
     }
+    return leaf_node_find(table, page_num, node, key);
 }
 
 Cursor* table_start(Table* table) {
     Cursor* cursor = table_find(table, 0);
     
-    void* node = get_page(table->pager, cursor->page_num);
+    void* node = get_page_for_read(table->pager, cursor->page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
     cursor->end_of_table = (num_cells == 0);
     
     return cursor;
 }
 
-static Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
-    void* node = get_page(table->pager, page_num);
+// Positions a cursor on the first row whose id is >= `key`, moving on to
+// the next leaf when the key sorts after everything in the one found.
+Cursor* table_seek(Table* table, uint32_t key) {
+    Cursor* cursor = table_find(table, key);
+    void* node = get_page_for_read(table->pager, cursor->page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
+    if (cursor->cell_num >= num_cells) {
+        if (num_cells == 0 || *leaf_node_next_leaf(node) == 0) {
+            cursor->end_of_table = true;
+        } else {
+            cursor->page_num = *leaf_node_next_leaf(node);
+            cursor->cell_num = 0;
+        }
+    }
+    return cursor;
+}
+
+// Positions a cursor on the last row whose id is <= `key`, stepping back to
+// the previous leaf when every row in the one found sorts after it. The
+// cursor is at the end when there is no such row; UINT32_MAX finds the
+// last row of the table in a single descent.
+Cursor* table_find_last(Table* table, uint32_t key) {
+    Cursor* cursor = table_find(table, key);
+    void* node = get_page_for_read(table->pager, cursor->page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
+    if (cursor->cell_num < num_cells && leaf_node_key(table->layout, node, cursor->cell_num) == key) {
+        return cursor;
+    }
+    if (cursor->cell_num > 0) {
+        cursor->cell_num -= 1;
+        return cursor;
+    }
+    uint32_t prev_page_num = *leaf_node_prev_leaf(node);
+    if (prev_page_num == 0) {
+        cursor->end_of_table = true;
+    } else {
+        cursor->page_num = prev_page_num;
+        cursor->cell_num = *leaf_node_num_cells(get_page_for_read(table->pager, prev_page_num)) - 1;
+    }
+    return cursor;
+}
+
+// Positions a cursor on the n-th row (0-based) in key order by descending
+// through the subtree counts instead of walking leaves.
+Cursor* table_find_nth(Table* table, uint32_t n) {
+    Pager* pager = table->pager;
+    pager_begin_operation(pager);
+    uint32_t page_num = table->root_page_num;
+    uint32_t frame_index;
+    void* node = pager_descend_root(pager, page_num, &frame_index);
 
     Cursor* cursor = new Cursor();
     cursor->table = table;
-    cursor->page_num = page_num;
+    explain_begin_descent(pager->trace);
+    explain_path_step(pager->trace, page_num);
+    if (n >= node_row_count(node)) {
+        cursor->page_num = page_num;
+        cursor->cell_num = 0;
+        cursor->end_of_table = true;
+        return cursor;
+    }
 
-    // Binary search
-    uint32_t min_index = 0;
-    uint32_t one_past_max_index = num_cells;
-    while (one_past_max_index != min_index) {
-        uint32_t index = (min_index + one_past_max_index) / 2;
-        uint32_t key_at_index = *leaf_node_key(node, index);
-        if (key == key_at_index) {
-            cursor->cell_num = index;
-            return cursor;
-        }
-        if (key < key_at_index) {
-            one_past_max_index = index;
-        } else {
-            min_index = index + 1;
+    while (get_node_type(node) == NODE_INTERNAL) {
+        uint32_t num_keys = *internal_node_num_keys(node);
+        uint32_t child_index = 0;
+        while (child_index < num_keys && n >= *internal_node_child_count(node, child_index)) {
+            n -= *internal_node_child_count(node, child_index);
+            child_index++;
         }
+        page_num = *internal_node_child(node, child_index);
+        explain_path_step(pager->trace, page_num);
+        node = pager_descend(pager, &frame_index, child_index, page_num);
     }
-    
-    cursor->cell_num = min_index;
+
+    cursor->page_num = page_num;
+    cursor->cell_num = n;
+    cursor->end_of_table = false;
     return cursor;
 }
 
-static Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
-    void* node = get_page(table->pager, page_num);
-    uint32_t num_keys = *internal_node_num_keys(node);
-    
-    uint32_t child_index = 0;
-    // Find the first key that is >= to the search key.
-    // The child pointer to the left of that key is the one we want.
-    for(child_index = 0; child_index < num_keys; child_index++) {
-        if(key <= *internal_node_key(node, child_index)) {
-            break;
-        }
-    }
-    
-    uint32_t child_num = *internal_node_child(node, child_index);
-    void* child = get_page(table->pager, child_num);
-    switch (get_node_type(child)) {
-        case NODE_LEAF:
-            return leaf_node_find(table, child_num, key);
-        case NODE_INTERNAL:
-            return internal_node_find(table, child_num, key);
-        default:
-            std::cerr << "Error: Invalid node type found in internal_node_find." << std::endl;
-            exit(EXIT_FAILURE);
+// Index of the first cell whose key is >= `key`, found in the packed keys
+// of a row leaf or the id minipage of a PAX leaf, read as 32-bit lanes
+// from a base of 0.
+static uint32_t leaf_node_lower_bound(const NodeLayout& layout, void* node, uint32_t key) {
+    uint32_t lane_size;
+    const char* lanes = leaf_node_search_lanes(layout, node, &lane_size);
+    uint32_t base = layout.leaf_layout == LEAF_LAYOUT_ROW ? *leaf_node_key_base(node) : 0;
+    return packed_keys_lower_bound(lanes, lane_size, base, *leaf_node_num_cells(node), key);
+}
+
+// The keys a search compares, in lanes of `lane_size` bytes: a row leaf's
+// packed deltas, or a PAX leaf's id minipage.
+static const char* leaf_node_search_lanes(const NodeLayout& layout, void* node, uint32_t* lane_size) {
+    if (layout.leaf_layout == LEAF_LAYOUT_ROW) {
+        *lane_size = *leaf_node_key_width(node) / 8;
+        return leaf_node_key_deltas(node);
     }
+    *lane_size = LEAF_NODE_KEY_SIZE;
+    return leaf_node_column(layout, node, 0, USERS_COLUMN_ID);
+}
+
+static Cursor* leaf_node_find(Table* table, uint32_t page_num, void* node, uint32_t key) {
+    explain_path_step(table->pager->trace, page_num);
+
+    Cursor* cursor = new Cursor();
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->cell_num = leaf_node_lower_bound(table->layout, node, key);
+    return cursor;
 }
@@ -3,33 +3,144 @@
 
 #include "pager.h"
 #include "row.h"
+#include "btree.h"
 
-// Table structure now just holds the pager and root page number.
+// Table structure holds the pager, the root page number and the node
+// capacities for the file's page size and the table's leaf layout. Every
+// table in a file shares the database's pager, and with it one buffer pool.
 struct Table {
     Pager* pager;
     uint32_t root_page_num;
+    NodeLayout layout;
+    std::string name;
 };
 
+// --- Catalog ---
+// A database file holds any number of tables, each its own B+ tree. The
+// catalog is one more tree, rooted at the header's root page, with a row
+// per table: the table's root page number as the key and a catalog record
+// as the value (see CatalogSchema below). Roots never move (a
+// root split copies the old root down and a collapse copies the only child
+// up), so a root page number names its table for as long as it exists.
+struct Database {
+    Pager* pager;
+    NodeLayout layout;
+    Table* catalog;
+    // Every table in the catalog, open until the database is closed or the
+    // table dropped.
+    std::vector<Table*> tables;
+    // What the database was opened with, to open it again after .reorganize.
+    std::string filename;
+    PagerOptions options;
+};
+
+// New files, and files from before the catalog, start with this table.
+const char* const DEFAULT_TABLE_NAME = "users";
+const char* const CATALOG_TABLE_NAME = "catalog";
+const uint32_t MAX_TABLE_NAME_LENGTH = 63;
+
+// A catalog record: the table's root page, its name, how its leaves are
+// laid out (a LeafLayout) and the shape of its rows, as a column count and
+// row size. Every table has the users columns for now, so the shape is
+// checked against UsersSchema on open rather than interpreted. The catalog
+// is a row-layout tree, and a record fills the front of a cell's value
+// slot, the rest of which stays zero.
+using CatalogSchema = Schema<Col<uint32_t>, Col<VarChar<MAX_TABLE_NAME_LENGTH>>, Col<uint32_t>, Col<uint32_t>, Col<uint32_t>>;
+enum CatalogColumn {
+    CATALOG_COLUMN_ROOT_PAGE,
+    CATALOG_COLUMN_NAME,
+    CATALOG_COLUMN_LEAF_LAYOUT,
+    CATALOG_COLUMN_NUM_COLUMNS,
+    CATALOG_COLUMN_ROW_SIZE
+};
+static_assert(CatalogSchema::row_size <= ROW_SIZE, "a catalog record fits in a catalog cell's value");
+
+// Consecutive leaf steps after which a cursor is treated as a scan and
+// starts reading ahead.
+const uint32_t READAHEAD_TRIGGER_LEAVES = 2;
+
+// Lookups a multi-get descends in lockstep. Every node on their paths stays
+// pinned until the group is done, so this bounds the extra frames in use.
+const uint32_t MULTIGET_GROUP_SIZE = 32;
+
+// .reorganize rebuilds the table into this file next to it, then renames it
+// over the original. Leaves are filled to the given percentage of capacity.
+const char* const REORGANIZE_SUFFIX = "-reorganize";
+const uint32_t REORGANIZE_DEFAULT_FILL_PERCENT = 90;
+const uint32_t REORGANIZE_MIN_FILL_PERCENT = 50;
+
 // A cursor points to a location within the B-Tree.
 struct Cursor {
     Table* table;
     uint32_t page_num;
     uint32_t cell_num;
     bool end_of_table;
+
+    // Read-ahead state: leaves stepped through in a row, and how far into
+    // the current leaf's parent the children have been prefetched.
+    uint32_t sequential_leaves;
+    uint32_t readahead_parent;
+    uint32_t readahead_next_child;
 };
 
 
+// Outcome of a write; the REPL turns these into messages.
+enum ExecuteResult { EXECUTE_SUCCESS, EXECUTE_DUPLICATE_KEY, EXECUTE_KEY_NOT_FOUND };
+
+// Columns an update assigns, as a bit mask. The id is the key and stays.
+enum UpdateColumn { UPDATE_USERNAME = 1 << 0, UPDATE_EMAIL = 1 << 1 };
+
+// --- Aggregates ---
+enum AggregateType { AGGREGATE_COUNT, AGGREGATE_MIN, AGGREGATE_MAX, AGGREGATE_SUM };
+// Column an aggregate is computed over; string columns aggregate their length.
+enum AggregateColumn { COLUMN_ID, COLUMN_USERNAME_LENGTH, COLUMN_EMAIL_LENGTH };
+
+struct AggregateResult {
+    bool is_null;
+    uint64_t value;
+};
+
+
+// --- Public API for Database Operations ---
+// `options.page_size` only applies when the file is created; an existing
+// database keeps the page size recorded in its header.
+Database* db_open(const std::string& filename, const PagerOptions& options = PagerOptions());
+void db_close(Database* database);
+void db_checkpoint(Database* database);
+uint32_t db_reorganize(Database* database, uint32_t fill_percent);
+// Returns nullptr when there is no such table (create: when there already
+// is one). Dropping frees every page of the table and deletes it.
+Table* db_table(Database* database, const std::string& name);
+Table* db_create_table(Database* database, const std::string& name, LeafLayout leaf_layout);
+bool db_drop_table(Database* database, const std::string& name);
+
 // --- Public API for Table Operations ---
-Table* db_open(const std::string& filename);
-void db_close(Table* table);
 
-void table_insert(Table* table, Row* row_to_insert);
-void table_delete(Table* table, uint32_t key);
+ExecuteResult table_insert(Table* table, Row* row_to_insert);
+uint32_t table_insert_batch(Table* table, Row* rows, uint32_t num_rows, ExecuteResult* results);
+ExecuteResult table_delete(Table* table, uint32_t key);
+uint32_t table_delete_range(Table* table, uint32_t start_key, uint32_t end_key);
+void table_truncate(Table* table);
+ExecuteResult table_update(Table* table, const Row* row, uint32_t columns);
+ExecuteResult table_upsert(Table* table, Row* row);
+bool table_lookup(Table* table, uint32_t key, RowView* row);
+uint32_t table_multiget(Table* table, const uint32_t* keys, uint32_t num_keys, Row* rows, bool* found);
+
+// --- Order-Statistic Queries (O(log n) via subtree row counts) ---
+uint32_t table_height(Table* table);
+uint32_t table_row_count(Table* table);
+uint32_t table_rank(Table* table, uint32_t key);
+uint32_t table_count_range(Table* table, uint32_t start_key, uint32_t end_key);
+AggregateResult table_aggregate(Table* table, AggregateType type, AggregateColumn column, uint32_t start_key, uint32_t end_key);
 
 // --- Cursor Operations ---
-void* cursor_value(Cursor* cursor);
+RowView cursor_row(Cursor* cursor);
 void cursor_advance(Cursor* cursor);
+void cursor_retreat(Cursor* cursor);
 Cursor* table_start(Table* table);
 Cursor* table_find(Table* table, uint32_t key);
+Cursor* table_find_nth(Table* table, uint32_t n);
+Cursor* table_seek(Table* table, uint32_t key);
+Cursor* table_find_last(Table* table, uint32_t key);
 
 #endif // TABLE_H
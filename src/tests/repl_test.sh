@@ -0,0 +1,82 @@
+#!/bin/sh
+# REPL tests: each case pipes statements into ./db on a fresh database and
+# checks the output for an expected line.
+# Usage (from src/): tests/repl_test.sh [path to db binary]
+
+DB=${1:-./db}
+FILE=$(mktemp -u /tmp/repl_test.XXXXXX)
+failures=0
+
+# expect <name> <expected line> <statements...>
+expect() {
+    name=$1
+    expected=$2
+    shift 2
+    rm -f "$FILE" "$FILE-warm"
+    output=$(printf '%s\n' "$@" ".exit" | "$DB" "$FILE" 2>&1)
+    if printf '%s\n' "$output" | grep -qxF "db > $expected"; then
+        echo "ok   $name"
+    else
+        echo "FAIL $name: expected '$expected', got:"
+        printf '%s\n' "$output"
+        failures=$((failures + 1))
+    fi
+}
+
+LONG_USERNAME=$(printf 'a%.0s' $(seq 1 33))
+LONG_EMAIL=$(printf 'a%.0s' $(seq 1 256))
+MAX_USERNAME=$(printf 'a%.0s' $(seq 1 32))
+MAX_EMAIL=$(printf 'a%.0s' $(seq 1 255))
+MAX_TABLE_NAME=$(printf 'n%.0s' $(seq 1 63))
+
+expect "insert and select" "(1, user1, person1@example.com)" \
+    "insert 1 user1 person1@example.com" "select"
+expect "insert rejects an overlong username" "String is too long." \
+    "insert 1 $LONG_USERNAME a@b"
+expect "upsert rejects an overlong username" "String is too long." \
+    "upsert 1 $LONG_USERNAME a@b"
+expect "upsert rejects an overlong email" "String is too long." \
+    "upsert 1 a $LONG_EMAIL"
+expect "upsert accepts values of the maximum length" "(1, $MAX_USERNAME, $MAX_EMAIL)" \
+    "upsert 1 $MAX_USERNAME $MAX_EMAIL" "select"
+expect "update rejects an overlong username" "String is too long." \
+    "insert 1 a b" "update 1 set username = $LONG_USERNAME"
+expect "update rejects an overlong email" "String is too long." \
+    "insert 1 a b" "update 1 set email = $LONG_EMAIL"
+expect "update accepts values of the maximum length" "(1, $MAX_USERNAME, $MAX_EMAIL)" \
+    "insert 1 a b" "update 1 set username = $MAX_USERNAME, email = $MAX_EMAIL" "select"
+expect "upsert rejects a negative id" "ID must be positive." \
+    "upsert -1 a b"
+expect "upsert replaces the row" "(1, b, c)" \
+    "insert 1 a a" "upsert 1 b c" "select"
+expect "create table rejects a column list" \
+    "Error: Column lists are not supported. Every table has the id, username and email columns." \
+    "create table t (id integer)"
+expect "create table accepts a name of the maximum length" "Executed." \
+    "create table $MAX_TABLE_NAME"
+expect "create table rejects an overlong name" \
+    "Error: Table names are up to 63 letters, digits or underscores, not starting with a digit." \
+    "create table ${MAX_TABLE_NAME}n"
+
+# A range delete leaves most of the tree on the free list, its nodes still
+# in the pool. The warm-up list saved on exit must name only the pages in
+# use: every page but the header and the free ones.
+rm -f "$FILE" "$FILE-warm"
+{ seq 1 20000 | sed 's/.*/insert & u e/'; echo "delete where id between 1 and 19000"; echo ".exit"; } |
+    "$DB" "$FILE" > /dev/null 2>&1
+warm_pages=$(od -An -tu4 -j12 -N4 "$FILE-warm" | tr -d ' ')
+stats=$(printf '.stats\n.exit\n' | "$DB" "$FILE" 2>&1)
+file_pages=$(printf '%s\n' "$stats" | sed -n 's/^file_pages: //p')
+free_pages=$(printf '%s\n' "$stats" | sed -n 's/^free_pages: //p')
+if [ "$warm_pages" = "$((file_pages - free_pages - 1))" ]; then
+    echo "ok   warm-up list leaves out pages freed by a range delete"
+else
+    echo "FAIL warm-up list leaves out pages freed by a range delete: $warm_pages listed, $file_pages pages, $free_pages free"
+    failures=$((failures + 1))
+fi
+
+rm -f "$FILE" "$FILE-warm"
+if [ "$failures" -ne 0 ]; then
+    echo "$failures failed"
+    exit 1
+fi